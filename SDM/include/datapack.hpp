@@ -0,0 +1,289 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_DATAPACK_H_HEADER_GUARD
+#define SDM_DATAPACK_H_HEADER_GUARD
+
+#include "iodata.hpp"
+
+/*
+ Packed dataset, one file in native (little) endian:
+
+   PackHeader
+   PackSample[numSamples]                      sample index
+   float[numSamples][2 * numLandmarks]         landmarks, row layout x_1 ... x_n, y_1 ... y_n
+   char[]                                      sample names
+   image payloads                              original image file bytes, each kPackAlign aligned
+
+ Every block starts kPackAlign aligned.
+ */
+
+namespace SDM
+{
+
+  const char     kPackMagic[8] = { 'S', 'D', 'M', 'P', 'A', 'C', 'K', '\0' };
+  const uint32_t kPackVersion = 1;
+  const uint64_t kPackAlign = 64;
+
+  struct PackHeader
+  {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  numSamples;
+    uint32_t  numLandmarks;
+    uint32_t  reserved;
+    uint64_t  indexOffset;
+    uint64_t  landmarkOffset;
+    uint64_t  nameOffset;
+    uint64_t  payloadOffset;
+    uint64_t  fileSize;
+  };
+  static_assert(sizeof(PackHeader) == 64, "PackHeader layout changed.");
+
+  struct PackSample
+  {
+    uint64_t  imageOffset;
+    uint64_t  imageSize;
+    uint64_t  nameOffset;
+    uint32_t  nameSize;
+    uint32_t  reserved;
+  };
+  static_assert(sizeof(PackSample) == 32, "PackSample layout changed.");
+
+  namespace detail
+  {
+    inline void writePadding(std::ofstream& _out, uint64_t _align)
+    {
+      static const char zeros[kPackAlign] = {};
+      uint64_t pos = uint64_t(_out.tellp() );
+      _out.write(zeros, X::alignUp(pos, _align) - pos);
+    }
+  }
+
+  /*!
+   Write images and landmarks into a pack file. Image files are stored as they are, not re-encoded.
+
+   @param _pack       Output pack file.
+   @param _images     Image files.
+   @param _landmarks  Landmarks of images, all with the same number of points.
+   */
+  inline void writePack(const fs::path& _pack, const std::vector<fs::path>& _images, const LandmarkSet& _landmarks)
+  {
+    if (_images.size() != _landmarks.size())
+    {
+      throw std::runtime_error("Dimensions not matched between images and landmarks.");
+    }
+
+    PackHeader header = {};
+    X::memCopy(header.magic, kPackMagic, sizeof(kPackMagic) );
+    header.version = kPackVersion;
+    header.numSamples = uint32_t(_images.size());
+    header.numLandmarks = _landmarks.numLandmarks();
+
+    // Lay out blocks first, so the index can be written before payloads.
+    std::vector<PackSample> samples(_images.size());
+    std::vector<std::string> names(_images.size());
+    header.indexOffset = X::alignUp(sizeof(PackHeader), kPackAlign);
+    header.landmarkOffset = X::alignUp(header.indexOffset + samples.size() * sizeof(PackSample), kPackAlign);
+    header.nameOffset = X::alignUp(header.landmarkOffset + uint64_t(header.numSamples) * header.numLandmarks * 2 * sizeof(float), kPackAlign);
+
+    uint64_t offset = header.nameOffset;
+    for (uint32_t ii = 0; ii < samples.size(); ++ii)
+    {
+      names[ii] = _images[ii].filename().string();
+      samples[ii].nameOffset = offset;
+      samples[ii].nameSize = uint32_t(names[ii].size());
+      offset += names[ii].size();
+    }
+    header.payloadOffset = X::alignUp(offset, kPackAlign);
+
+    offset = header.payloadOffset;
+    for (uint32_t ii = 0; ii < samples.size(); ++ii)
+    {
+      samples[ii].imageOffset = offset;
+      samples[ii].imageSize = fs::file_size(_images[ii]);
+      offset = X::alignUp(offset + samples[ii].imageSize, kPackAlign);
+    }
+    header.fileSize = offset;
+
+    std::ofstream out(_pack.string(), std::ios::binary | std::ios::trunc);
+    if (false == out.is_open())
+    {
+      throw std::runtime_error(std::string("Could not create pack file: " + _pack.string()));
+    }
+
+    out.write((const char*)&header, sizeof(header));
+    detail::writePadding(out, kPackAlign);
+    out.write((const char*)samples.data(), samples.size() * sizeof(PackSample));
+    detail::writePadding(out, kPackAlign);
+
+    out.write((const char*)_landmarks.data(), uint64_t(header.numSamples) * header.numLandmarks * 2 * sizeof(float));
+    detail::writePadding(out, kPackAlign);
+
+    for (auto& name : names)
+      out.write(name.data(), name.size());
+    detail::writePadding(out, kPackAlign);
+
+    std::vector<char> buffer;
+    for (uint32_t ii = 0; ii < samples.size(); ++ii)
+    {
+      int64_t size = X::readFile(_images[ii].string().c_str(), buffer);
+      if (size < 0 || uint64_t(size) != samples[ii].imageSize)
+      {
+        throw std::runtime_error(std::string("Could not read image file: " + _images[ii].string()));
+      }
+      out.write(buffer.data(), size);
+      detail::writePadding(out, kPackAlign);
+    }
+
+    if (!out.good() || uint64_t(out.tellp()) != header.fileSize)
+    {
+      throw std::runtime_error(std::string("Could not write pack file: " + _pack.string()));
+    }
+  }
+
+  /*!
+   IO implement for read a memory mapped pack file. Landmark rows and image bytes point directly
+   into the mapping, and processes reading the same pack share its pages.
+   */
+  class PackIO : public IData
+  {
+  public:
+
+    /*!
+     Map pack file and validate its layout.
+
+     @param _pack       Pack file written by \c writePack.
+     @param _numThreads Threads decoding images in \c getData, 0 means one per hardware thread.
+     */
+    PackIO(const fs::path& _pack, uint32_t _numThreads = 1)
+      : m_numThreads(_numThreads)
+    {
+      if (!m_file.open(_pack.string().c_str()) || m_file.size() < sizeof(PackHeader))
+      {
+        throw std::runtime_error(std::string("Could not map pack file: " + _pack.string()));
+      }
+
+      m_header = (const PackHeader*)m_file.data();
+      if (0 != X::memCmp(m_header->magic, kPackMagic, sizeof(kPackMagic)) || kPackVersion != m_header->version)
+      {
+        throw std::runtime_error(std::string("Not a pack file or unsupported version: " + _pack.string()));
+      }
+
+      uint64_t row_bytes = uint64_t(m_header->numLandmarks) * 2 * sizeof(float);
+      if (m_header->fileSize != m_file.size()
+          || m_header->indexOffset + uint64_t(m_header->numSamples) * sizeof(PackSample) > m_file.size()
+          || m_header->landmarkOffset + uint64_t(m_header->numSamples) * row_bytes > m_file.size() )
+      {
+        throw std::runtime_error(std::string("Pack file is truncated: " + _pack.string()));
+      }
+
+      m_samples = (const PackSample*)(m_file.data() + m_header->indexOffset);
+      m_filenames.reserve(m_header->numSamples);
+      for (uint32_t ii = 0; ii < m_header->numSamples; ++ii)
+      {
+        const PackSample& sample = m_samples[ii];
+        if (sample.nameOffset + sample.nameSize > m_file.size() || sample.imageOffset + sample.imageSize > m_file.size())
+        {
+          throw std::runtime_error(std::string("Pack file is truncated: " + _pack.string()));
+        }
+        m_filenames.emplace_back(std::string((const char*)m_file.data() + sample.nameOffset, sample.nameSize));
+      }
+    }
+
+    /// Number of samples.
+    uint32_t size() const { return m_header->numSamples; }
+
+    /// Number of landmarks per sample.
+    uint32_t numLandmarks() const { return m_header->numLandmarks; }
+
+    /*!
+     Landmarks of sample \c _index without copy, valid as long as this \c PackIO lives.
+
+     @return  1 x 2n CV_32F row x_1 ... x_n, y_1 ... y_n, must not be written.
+     */
+    cv::Mat getLandmarkRow(uint32_t _index) const
+    {
+      const uint8_t* row = m_file.data() + m_header->landmarkOffset + uint64_t(_index) * m_header->numLandmarks * 2 * sizeof(float);
+      return cv::Mat(1, m_header->numLandmarks * 2, CV_32F, (void*)row);
+    }
+
+    /*!
+     Image file bytes of sample \c _index without copy, valid as long as this \c PackIO lives.
+
+     @return  1 x size CV_8U row, must not be written.
+     */
+    cv::Mat getImageBytes(uint32_t _index) const
+    {
+      const PackSample& sample = m_samples[_index];
+      return cv::Mat(1, int(sample.imageSize), CV_8U, (void*)(m_file.data() + sample.imageOffset));
+    }
+
+    /*!
+     Decode only the part of image \c _index covering \c _roi, see \c decodeImageRegion.
+     */
+    virtual cv::Mat getImageRegion(uint32_t _index, cv::Rect& _roi)
+    {
+      const PackSample& sample = m_samples[_index];
+      return decodeImageRegion(m_file.data() + sample.imageOffset, size_t(sample.imageSize), _roi);
+    }
+
+    virtual cv::Mat getImage(uint32_t _index)
+    {
+      return cv::imdecode(getImageBytes(_index), cv::IMREAD_COLOR);
+    }
+
+    virtual const std::vector<cv::Mat>& getData()
+    {
+      if (m_images.empty() && 0 != size())
+      {
+        m_images.resize(size());
+        X::parallelFor(size(), m_numThreads,
+                       [this](uint32_t, uint32_t _ii){ m_images[_ii] = getImage(_ii); } );
+      }
+      return m_images;
+    }
+
+    virtual const LandmarkSet& getLandmarks()
+    {
+      if (m_landmarks.empty() && 0 != size())
+      {
+        m_landmarks = LandmarkSet(numberedLandmarkNames(numLandmarks()), size());
+        X::memCopy(m_landmarks.data(), m_file.data() + m_header->landmarkOffset, size_t(size()) * numLandmarks() * 2 * sizeof(float));
+      }
+      return m_landmarks;
+    }
+
+    virtual const std::vector<fs::path>& getFilenames()
+    {
+      return m_filenames;
+    }
+
+  private:
+    uint32_t                m_numThreads;
+    X::MappedFile           m_file;
+    const PackHeader*       m_header;
+    const PackSample*       m_samples;
+    std::vector<fs::path>   m_filenames;
+    std::vector<cv::Mat>    m_images;
+    LandmarkSet             m_landmarks;
+  };
+
+}
+
+#endif  //SDM_DATAPACK_H_HEADER_GUARD
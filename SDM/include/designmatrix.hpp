@@ -0,0 +1,78 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_DESIGNMATRIX_H_HEADER_GUARD
+#define SDM_DESIGNMATRIX_H_HEADER_GUARD
+
+#include <opencv2/core/core.hpp>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "xthread.hpp"
+
+namespace SDM
+{
+
+  const size_t kCacheLine = 64;
+
+  /*!
+   Continuous matrix whose data starts on a cache line. It is a view into a slightly larger
+   buffer, reference counted like any \c cv::Mat, so it may be passed on and outlive the caller.
+   Throws if the buffer has more elements than a \c cv::Mat row can address.
+   */
+  inline cv::Mat allocateAligned(int _rows, int _cols, int _type = CV_32F)
+  {
+    size_t elem_size = CV_ELEM_SIZE(_type);
+    size_t total = size_t(_rows) * size_t(_cols);
+    if (0 == total)
+      return cv::Mat(_rows, _cols, _type);
+
+    size_t pad = kCacheLine / elem_size;
+    if (total > size_t(std::numeric_limits<int>::max()) - pad)
+    {
+      throw std::runtime_error("Matrix of " + std::to_string(_rows) + " x " + std::to_string(_cols) + " elements is too large.");
+    }
+    cv::Mat buffer(1, int(total + pad), _type);
+    size_t misalign = size_t(buffer.data) % kCacheLine;
+    int offset = misalign ? int((kCacheLine - misalign) / elem_size) : 0;
+    return buffer.colRange(offset, offset + int(total)).reshape(0, _rows);
+  }
+
+  /*!
+   Allocate a \c _numRows x \c _numCols CV_32F design matrix once and fill it in parallel, a row
+   per call of \c _fill(row, dst) with \c dst one row of \c _numCols floats. Rows are samples,
+   the row major layout superviseddescent maps into Eigen. Rows must not depend on each other or
+   on the thread filling them.
+
+   @param _grain   Rows per parallel task.
+   */
+  template<typename Fn>
+  cv::Mat buildDesignMatrix(uint32_t _numRows, uint32_t _numCols, uint32_t _numThreads, Fn _fill, uint32_t _grain = 16)
+  {
+    cv::Mat matrix = allocateAligned(int(_numRows), int(_numCols) );
+    X::parallelFor(_numRows, _numThreads, [&](uint32_t, uint32_t _row)
+    {
+      _fill(_row, matrix.ptr<float>(int(_row)) );
+    }, _grain);
+    return matrix;
+  }
+
+}
+
+#endif  //SDM_DESIGNMATRIX_H_HEADER_GUARD
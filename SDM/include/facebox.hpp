@@ -0,0 +1,190 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_FACEBOX_H_HEADER_GUARD
+#define SDM_FACEBOX_H_HEADER_GUARD
+
+#include "iodata.hpp"
+#include "facecache.hpp"
+
+namespace SDM
+{
+
+  /// Fewer pairs give no usable spread, a single one fits sigmas of 0.
+  const uint32_t kMinBoxCalibrationSamples = 10;
+
+  /*!
+   Affine map from the bounding box of annotated landmarks to the box a face detector returns for
+   the same face, relative to the landmark box so it holds at every scale:
+
+     center = landmark center + (offsetX * width, offsetY * height)
+     size   = (scaleX * width, scaleY * height)
+
+   Spread of detections around the map is kept as ratios of the detector box, the parameters of
+   \c X::perturb, so sampled boxes jitter like real detections. The map only holds for the detector
+   it was fitted on, which is saved with it.
+   */
+  struct BoxCalibration
+  {
+    BoxCalibration()
+      : offsetX(0.f)
+      , offsetY(0.f)
+      , scaleX(1.f)
+      , scaleY(1.f)
+      , sigmaX(0.f)
+      , sigmaY(0.f)
+      , sigmaScale(0.f)
+      , numSamples(0)
+    {
+    }
+
+    float     offsetX;
+    float     offsetY;
+    float     scaleX;
+    float     scaleY;
+    float     sigmaX;     //!< Translation spread, ratio of box width.
+    float     sigmaY;     //!< Translation spread, ratio of box height.
+    float     sigmaScale; //!< Relative size spread.
+    uint32_t  numSamples; //!< Pairs fitted on.
+    FaceDetectorParams detector; //!< Detector the face boxes came from.
+
+    /*!
+     Least squares fit on pairs of landmark and detector boxes of the same faces.
+
+     @param _landmarks  Landmark boxes, see \c landmarkBounds.
+     @param _faces      Detected boxes, same order.
+     @param _detector   Detector of \c _faces.
+     @param _minSamples Fewest pairs to fit on, at least 2.
+     */
+    static BoxCalibration fit(const std::vector<cv::Rect>& _landmarks, const std::vector<cv::Rect>& _faces,
+                              const FaceDetectorParams& _detector, uint32_t _minSamples = kMinBoxCalibrationSamples)
+    {
+      if (_landmarks.size() != _faces.size())
+      {
+        throw std::runtime_error("Box calibration needs matching landmark and face boxes.");
+      }
+      if (_landmarks.size() < std::max<uint32_t>(_minSamples, 2))
+      {
+        throw std::runtime_error("Box calibration needs at least " + std::to_string(std::max<uint32_t>(_minSamples, 2))
+                                 + " faces, got " + std::to_string(_landmarks.size()) + ".");
+      }
+
+      // Relative to the landmark box every term is a plain mean, see struct doc.
+      size_t num = _landmarks.size();
+      std::vector<double> dx(num), dy(num), sx(num), sy(num);
+      BoxCalibration calibration;
+      double sum[4] = {};
+      for (size_t ii = 0; ii < num; ++ii)
+      {
+        const cv::Rect& lmk = _landmarks[ii];
+        const cv::Rect& face = _faces[ii];
+        dx[ii] = (face.x + face.width * .5 - lmk.x - lmk.width * .5) / lmk.width;
+        dy[ii] = (face.y + face.height * .5 - lmk.y - lmk.height * .5) / lmk.height;
+        sx[ii] = double(face.width) / lmk.width;
+        sy[ii] = double(face.height) / lmk.height;
+        sum[0] += dx[ii]; sum[1] += dy[ii]; sum[2] += sx[ii]; sum[3] += sy[ii];
+      }
+      calibration.offsetX = float(sum[0] / num);
+      calibration.offsetY = float(sum[1] / num);
+      calibration.scaleX = float(sum[2] / num);
+      calibration.scaleY = float(sum[3] / num);
+
+      // Residuals in units of the detector box.
+      double var[3] = {};
+      for (size_t ii = 0; ii < num; ++ii)
+      {
+        double rx = (dx[ii] - calibration.offsetX) / calibration.scaleX;
+        double ry = (dy[ii] - calibration.offsetY) / calibration.scaleY;
+        double rs = 0.5 * (sx[ii] / calibration.scaleX + sy[ii] / calibration.scaleY) - 1.;
+        var[0] += rx * rx; var[1] += ry * ry; var[2] += rs * rs;
+      }
+      calibration.sigmaX = float(std::sqrt(var[0] / num));
+      calibration.sigmaY = float(std::sqrt(var[1] / num));
+      calibration.sigmaScale = float(std::sqrt(var[2] / num));
+      calibration.numSamples = uint32_t(num);
+      calibration.detector = _detector;
+      return calibration;
+    }
+
+    /// Expected detector box of landmark box \c _landmarks.
+    cv::Rect apply(const cv::Rect& _landmarks) const
+    {
+      float width = scaleX * _landmarks.width;
+      float height = scaleY * _landmarks.height;
+      float cx = _landmarks.x + _landmarks.width * (.5f + offsetX);
+      float cy = _landmarks.y + _landmarks.height * (.5f + offsetY);
+      return cv::Rect(int32_t(std::round(cx - width * .5f)), int32_t(std::round(cy - height * .5f)),
+                      int32_t(std::round(width)), int32_t(std::round(height)) );
+    }
+
+    /// Write as boost info file.
+    void save(const fs::path& _file) const
+    {
+      boost::property_tree::ptree tree;
+      tree.put("offsetX", offsetX);
+      tree.put("offsetY", offsetY);
+      tree.put("scaleX", scaleX);
+      tree.put("scaleY", scaleY);
+      tree.put("sigmaX", sigmaX);
+      tree.put("sigmaY", sigmaY);
+      tree.put("sigmaScale", sigmaScale);
+      tree.put("numSamples", numSamples);
+      tree.put("detector.cascade", detector.cascade);
+      tree.put("detector.cascadeHash", detector.cascadeHash);
+      tree.put("detector.scaleFactor", detector.scaleFactor);
+      tree.put("detector.minNeighbors", detector.minNeighbors);
+      tree.put("detector.flags", detector.flags);
+      tree.put("detector.minWidth", detector.minSize.width);
+      tree.put("detector.minHeight", detector.minSize.height);
+      tree.put("detector.imreadFlags", detector.imreadFlags);
+      tree.put("detector.guidePadding", detector.guidePadding);
+      boost::property_tree::write_info(_file.string(), tree);
+    }
+
+    /// Read file written by \c save, throws if it is missing or incomplete. Files without detector
+    /// parameters load with default ones, which match no training detector.
+    static BoxCalibration load(const fs::path& _file)
+    {
+      boost::property_tree::ptree tree;
+      boost::property_tree::read_info(_file.string(), tree);
+      BoxCalibration calibration;
+      calibration.offsetX = tree.get<float>("offsetX");
+      calibration.offsetY = tree.get<float>("offsetY");
+      calibration.scaleX = tree.get<float>("scaleX");
+      calibration.scaleY = tree.get<float>("scaleY");
+      calibration.sigmaX = tree.get<float>("sigmaX");
+      calibration.sigmaY = tree.get<float>("sigmaY");
+      calibration.sigmaScale = tree.get<float>("sigmaScale");
+      calibration.numSamples = tree.get<uint32_t>("numSamples");
+      FaceDetectorParams& detector = calibration.detector;
+      detector.cascade = tree.get<std::string>("detector.cascade", detector.cascade);
+      detector.cascadeHash = tree.get<uint64_t>("detector.cascadeHash", detector.cascadeHash);
+      detector.scaleFactor = tree.get<double>("detector.scaleFactor", detector.scaleFactor);
+      detector.minNeighbors = tree.get<int32_t>("detector.minNeighbors", detector.minNeighbors);
+      detector.flags = tree.get<int32_t>("detector.flags", detector.flags);
+      detector.minSize.width = tree.get<int32_t>("detector.minWidth", detector.minSize.width);
+      detector.minSize.height = tree.get<int32_t>("detector.minHeight", detector.minSize.height);
+      detector.imreadFlags = tree.get<int32_t>("detector.imreadFlags", detector.imreadFlags);
+      detector.guidePadding = tree.get<float>("detector.guidePadding", detector.guidePadding);
+      return calibration;
+    }
+  };
+
+}
+
+#endif  //SDM_FACEBOX_H_HEADER_GUARD
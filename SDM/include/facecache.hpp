@@ -0,0 +1,331 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_FACECACHE_H_HEADER_GUARD
+#define SDM_FACECACHE_H_HEADER_GUARD
+
+#include "iodata.hpp"
+
+/*
+ Face detection cache, one file in native endian:
+
+   magic, version
+   FaceDetectorParams                          detections of other parameters are not loaded
+   uint32_t numEntries
+   entries                                     contentHash, landmarksHash, valid, numFaces, int32_t[numFaces][4]
+   uint32_t numStamps
+   stamps                                      path, size, mtime, contentHash
+ */
+
+namespace SDM
+{
+
+  const char     kFaceCacheMagic[8] = { 'S', 'D', 'M', 'F', 'A', 'C', 'E', 'S' };
+  const uint32_t kFaceCacheVersion = 3;
+
+  /// Everything the output of \c cv::CascadeClassifier::detectMultiScale depends on, besides pixels.
+  struct FaceDetectorParams
+  {
+    FaceDetectorParams()
+      : cascadeHash(0)
+      , scaleFactor(1.1)
+      , minNeighbors(3)
+      , flags(0)
+      , imreadFlags(cv::IMREAD_COLOR)
+      , guidePadding(-1.f)
+    {
+    }
+
+    std::string cascade;      //!< Cascade file.
+    uint64_t    cascadeHash;  //!< Content of cascade file, see \c hashFile.
+    double      scaleFactor;
+    int32_t     minNeighbors;
+    int32_t     flags;
+    cv::Size    minSize;
+    int32_t     imreadFlags;  //!< Decode flags of images, reduction changes detections.
+    float       guidePadding; //!< Search only around annotated landmarks, see \c detectFaces in training. Negative searches the full frame.
+    
+    /// Whether detections depend on landmarks as well as pixels.
+    bool isGuided() const { return guidePadding >= 0.f; }
+
+    bool operator==(const FaceDetectorParams& _other) const
+    {
+      return cascade == _other.cascade && cascadeHash == _other.cascadeHash && scaleFactor == _other.scaleFactor
+          && minNeighbors == _other.minNeighbors && flags == _other.flags && minSize == _other.minSize
+          && imreadFlags == _other.imreadFlags && guidePadding == _other.guidePadding;
+    }
+  };
+
+  /// Cached result of one image.
+  struct FaceDetection
+  {
+    FaceDetection()
+      : landmarksHash(0)
+      , valid(-1)
+    {
+    }
+
+    std::vector<cv::Rect> faces;          //!< Raw \c detectMultiScale output.
+    uint64_t              landmarksHash;  //!< Landmarks \c valid, and \c faces of guided detection, were decided on.
+    int32_t               valid;          //!< Index of the face accepted for the landmarks, -1 if none.
+  };
+
+  /*!
+   Fingerprint of file content for \c FaceDetectionCache keys.
+
+   @return  Hash, 0 if the file could not be read.
+   */
+  inline uint64_t hashFile(const fs::path& _file)
+  {
+    std::vector<char> buffer;
+    int64_t size = X::readFile(_file.string().c_str(), buffer);
+    return size < 0 ? 0 : X::hash64(buffer.data(), size_t(size));
+  }
+
+  /// Content hash of a file, valid while the file keeps its size and mtime.
+  struct FileStamp
+  {
+    uint64_t  size;
+    int64_t   time;
+    uint64_t  contentHash;
+  };
+
+  /*!
+   On disk cache of face detections keyed by image content, so a retrain only detects faces of new or
+   changed images. Files written with other detector parameters are ignored and replaced on \c save.
+   Content hashes are stored with size and mtime of their file, so unchanged images are not read
+   again just to look them up.
+
+   \c find and \c contentHash may be called from several threads as long as nobody calls \c insert.
+   */
+  class FaceDetectionCache
+  {
+  public:
+
+    /*!
+     Load cache file \c _file if it exists and was written with \c _params.
+     */
+    FaceDetectionCache(const fs::path& _file, const FaceDetectorParams& _params)
+      : m_file(_file)
+      , m_params(_params)
+      , m_dirty(false)
+    {
+      if (!load() )
+      {
+        m_entries.clear();
+        m_stamps.clear();
+      }
+    }
+
+    /// Number of cached images.
+    size_t size() const { return m_entries.size(); }
+
+    /*!
+     Content hash of image file \c _file, see \c hashFile. The file is read and hashed only if its
+     size or mtime changed since the hash was stored.
+
+     @return  Hash, 0 if the file could not be read.
+     */
+    uint64_t contentHash(const fs::path& _file)
+    {
+      boost::system::error_code error;
+      uint64_t size = fs::file_size(_file, error);
+      if (error)
+        return 0;
+      int64_t time = int64_t(fs::last_write_time(_file, error));
+      if (error)
+        return 0;
+
+      std::string key = _file.string();
+      {
+        std::lock_guard<std::mutex> lock(m_stampMutex);
+        auto found = m_stamps.find(key);
+        if (found != m_stamps.end() && found->second.size == size && found->second.time == time)
+          return found->second.contentHash;
+      }
+
+      uint64_t hash = hashFile(_file);
+      if (0 != hash)
+      {
+        std::lock_guard<std::mutex> lock(m_stampMutex);
+        m_stamps[key] = FileStamp{ size, time, hash };
+        m_dirty = true;
+      }
+      return hash;
+    }
+
+    /*!
+     Look up detections of image with content hash \c _contentHash.
+
+     @return  False if the image was not detected yet.
+     */
+    bool find(uint64_t _contentHash, FaceDetection& _detection) const
+    {
+      auto found = m_entries.find(_contentHash);
+      if (found == m_entries.end())
+        return false;
+      _detection = found->second;
+      return true;
+    }
+
+    /// Add or replace detections of image with content hash \c _contentHash.
+    void insert(uint64_t _contentHash, const FaceDetection& _detection)
+    {
+      m_entries[_contentHash] = _detection;
+      m_dirty = true;
+    }
+
+    /*!
+     Write cache file if anything was inserted, through a temporary file renamed in place. A failure
+     only costs the next run a detection pass, so it is reported and not thrown.
+     */
+    void save()
+    {
+      if (!m_dirty)
+        return;
+
+      fs::path tmp = m_file;
+      tmp += fs::unique_path(".%%%%-%%%%");
+      try
+      {
+        {
+          std::ofstream out(tmp.string(), std::ios::binary | std::ios::trunc);
+          if (false == out.is_open())
+          {
+            throw std::runtime_error(std::string("Could not create face cache file: " + tmp.string()));
+          }
+          out.write(kFaceCacheMagic, sizeof(kFaceCacheMagic));
+          detail::writePod(out, kFaceCacheVersion);
+          detail::writeString(out, m_params.cascade);
+          detail::writePod(out, m_params.cascadeHash);
+          detail::writePod(out, m_params.scaleFactor);
+          detail::writePod(out, m_params.minNeighbors);
+          detail::writePod(out, m_params.flags);
+          detail::writePod(out, int32_t(m_params.minSize.width));
+          detail::writePod(out, int32_t(m_params.minSize.height));
+          detail::writePod(out, m_params.imreadFlags);
+          detail::writePod(out, m_params.guidePadding);
+          detail::writePod(out, uint32_t(m_entries.size()));
+          for (auto& entry : m_entries)
+          {
+            detail::writePod(out, entry.first);
+            detail::writePod(out, entry.second.landmarksHash);
+            detail::writePod(out, entry.second.valid);
+            detail::writePod(out, uint32_t(entry.second.faces.size()));
+            for (auto& face : entry.second.faces)
+            {
+              int32_t box[4] = { face.x, face.y, face.width, face.height };
+              out.write((const char*)box, sizeof(box));
+            }
+          }
+          detail::writePod(out, uint32_t(m_stamps.size()));
+          for (auto& stamp : m_stamps)
+          {
+            detail::writeString(out, stamp.first);
+            detail::writePod(out, stamp.second.size);
+            detail::writePod(out, stamp.second.time);
+            detail::writePod(out, stamp.second.contentHash);
+          }
+          if (!out.good())
+          {
+            throw std::runtime_error(std::string("Could not write face cache file: " + tmp.string()));
+          }
+        }
+        fs::rename(tmp, m_file);
+        m_dirty = false;
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << e.what() << std::endl;
+        boost::system::error_code ec;
+        fs::remove(tmp, ec);
+      }
+    }
+
+  private:
+    /// @return  False if the file does not exist, is corrupted, of another version or other parameters.
+    bool load()
+    {
+      std::vector<char> buffer;
+      int64_t size = X::readFile(m_file.string().c_str(), buffer);
+      if (size < int64_t(sizeof(kFaceCacheMagic)) || 0 != X::memCmp(buffer.data(), kFaceCacheMagic, sizeof(kFaceCacheMagic)))
+        return false;
+
+      detail::BinaryReader reader{ buffer.data() + sizeof(kFaceCacheMagic), buffer.data() + size };
+      FaceDetectorParams params;
+      uint32_t version, num_entries;
+      int32_t min_width, min_height;
+      if (!(reader.read(version) && kFaceCacheVersion == version
+            && reader.read(params.cascade) && reader.read(params.cascadeHash)
+            && reader.read(params.scaleFactor) && reader.read(params.minNeighbors) && reader.read(params.flags)
+            && reader.read(min_width) && reader.read(min_height) && reader.read(params.imreadFlags) && reader.read(params.guidePadding)
+            && reader.read(num_entries) ) )
+        return false;
+      params.minSize = cv::Size(min_width, min_height);
+      if (!(params == m_params))
+        return false;
+
+      m_entries.reserve(num_entries);
+      for (uint32_t ii = 0; ii < num_entries; ++ii)
+      {
+        uint64_t content_hash;
+        uint32_t num_faces;
+        FaceDetection detection;
+        if (!(reader.read(content_hash) && reader.read(detection.landmarksHash)
+              && reader.read(detection.valid) && reader.read(num_faces) ) )
+          return false;
+        if (detection.valid < -1 || detection.valid >= int64_t(num_faces))
+          return false;
+        if (size_t(reader.end - reader.ptr) < size_t(num_faces) * 4 * sizeof(int32_t))
+          return false;
+        detection.faces.resize(num_faces);
+        for (auto& face : detection.faces)
+        {
+          int32_t box[4];
+          reader.read(box);
+          face = cv::Rect(box[0], box[1], box[2], box[3]);
+        }
+        m_entries[content_hash] = std::move(detection);
+      }
+
+      uint32_t num_stamps;
+      if (!reader.read(num_stamps))
+        return false;
+      m_stamps.reserve(num_stamps);
+      for (uint32_t ii = 0; ii < num_stamps; ++ii)
+      {
+        std::string path;
+        FileStamp stamp;
+        if (!(reader.read(path) && reader.read(stamp.size) && reader.read(stamp.time) && reader.read(stamp.contentHash) ) )
+          return false;
+        m_stamps[path] = stamp;
+      }
+      return reader.ptr == reader.end;
+    }
+
+    fs::path                                      m_file;
+    FaceDetectorParams                            m_params;
+    std::unordered_map<uint64_t, FaceDetection>   m_entries;
+    std::unordered_map<std::string, FileStamp>    m_stamps;
+    std::mutex                                    m_stampMutex;
+    bool                                          m_dirty;
+  };
+
+}
+
+#endif  //SDM_FACECACHE_H_HEADER_GUARD
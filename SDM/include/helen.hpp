@@ -0,0 +1,112 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_HELEN_H_HEADER_GUARD
+#define SDM_HELEN_H_HEADER_GUARD
+
+#include <stdint.h> // uint16_t
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace SDM
+{
+  /*!
+   Compile time layout of Helen 194 annotations. Constants are 0-based indices into a landmark row
+   x_1 ... x_n, y_1 ... y_n or a landmark collection. Annotation files and rcr name landmarks by their
+   1-based id instead, index i is named "i + 1".
+   */
+  namespace Helen
+  {
+    constexpr uint16_t kNumLandmarks = 194;
+
+    /// Index of 1-based annotation id \c _id.
+    constexpr uint16_t index(uint16_t _id) { return uint16_t(_id - 1); }
+
+    /// 1-based annotation id of index \c _index.
+    constexpr uint16_t id(uint16_t _index) { return uint16_t(_index + 1); }
+
+    struct EyeCorners
+    {
+      uint16_t inCorner;
+      uint16_t outCorner;
+    };
+
+    /// Half open index range [begin, end).
+    struct Range
+    {
+      uint16_t begin;
+      uint16_t end;
+    };
+
+    constexpr EyeCorners kLeftEye  = { index(134), index(144) };
+    constexpr EyeCorners kRightEye = { index(114), index(124) };
+    constexpr Range      kOuterMouth = { index(58), index(85) };
+    constexpr Range      kInnerMouth = { index(86), index(113) };
+
+    /// Points a detected face box must contain: outer corners of both eyes and a point of inner mouth.
+    constexpr uint16_t   kValidation[] = { kLeftEye.outCorner, kRightEye.outCorner, index(95) };
+
+    static_assert(kLeftEye.outCorner < kNumLandmarks && kRightEye.outCorner < kNumLandmarks, "Eye corner out of range.");
+    static_assert(kLeftEye.inCorner < kLeftEye.outCorner && kRightEye.inCorner < kRightEye.outCorner, "rcr sums eye corners in landmark order.");
+    static_assert(kOuterMouth.end <= kInnerMouth.begin && kInnerMouth.end <= kNumLandmarks, "Mouth range out of range.");
+
+    /// rcr style names of \c _eye corners, inner corner first.
+    inline std::vector<std::string> names(const EyeCorners& _eye)
+    {
+      return { std::to_string(id(_eye.inCorner)), std::to_string(id(_eye.outCorner)) };
+    }
+
+    /*!
+     Distance between eye centres, a centre being the mean of its two corners. Same distance as
+     \c rcr::get_ied with the eye names, without name lookup, up to rounding, see
+     \c rcrInterEyeDistance.
+
+     @param _x  x coordinates of a sample.
+     @param _y  y coordinates of the sample.
+     */
+    template<typename Ty>
+    Ty interEyeDistance(const Ty* _x, const Ty* _y)
+    {
+      Ty dx = (_x[kLeftEye.inCorner] + _x[kLeftEye.outCorner] - _x[kRightEye.inCorner] - _x[kRightEye.outCorner]) / Ty(2);
+      Ty dy = (_y[kLeftEye.inCorner] + _y[kLeftEye.outCorner] - _y[kRightEye.inCorner] - _y[kRightEye.outCorner]) / Ty(2);
+      return std::sqrt(dx * dx + dy * dy);
+    }
+
+    /*!
+     \c interEyeDistance rounded exactly like \c rcr::get_ied, which sizes the patches of
+     \c rcr::HogTransform: eye centres are float means of their corners summed in landmark order,
+     the distance between them is taken in double like \c cv::norm.
+
+     @param _x  x coordinates of a sample.
+     @param _y  y coordinates of the sample.
+     */
+    inline double rcrInterEyeDistance(const float* _x, const float* _y)
+    {
+      float right_x = (0.f + _x[kRightEye.inCorner] + _x[kRightEye.outCorner]) / 2.f;
+      float right_y = (0.f + _y[kRightEye.inCorner] + _y[kRightEye.outCorner]) / 2.f;
+      float left_x = (0.f + _x[kLeftEye.inCorner] + _x[kLeftEye.outCorner]) / 2.f;
+      float left_y = (0.f + _y[kLeftEye.inCorner] + _y[kLeftEye.outCorner]) / 2.f;
+      double dx = double(right_x - left_x);
+      double dy = double(right_y - left_y);
+      return std::sqrt(dx * dx + dy * dy);
+    }
+  }
+}
+
+#endif  //SDM_HELEN_H_HEADER_GUARD
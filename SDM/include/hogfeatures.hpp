@@ -0,0 +1,158 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_HOGFEATURES_H_HEADER_GUARD
+#define SDM_HOGFEATURES_H_HEADER_GUARD
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "iodata.hpp"
+
+namespace SDM
+{
+
+  /// Per image state of \c HogFeatures, computed once and read by every sample of the image.
+  struct FeatureContext
+  {
+    cv::Mat gray; //!< 8 bit single channel image the patches are cut from.
+  };
+
+  inline FeatureContext makeFeatureContext(const cv::Mat& _image)
+  {
+    FeatureContext context;
+    if (3 == _image.channels())
+      cv::cvtColor(_image, context.gray, cv::COLOR_BGR2GRAY);
+    else
+      context.gray = _image;
+    return context;
+  }
+
+  /*!
+   Copy the \c _size x \c _size patch of \c _gray with top left corner (_x, _y) into \c _patch,
+   pixels outside the image are 0.
+   */
+  inline void extractPatch(const cv::Mat& _gray, int32_t _x, int32_t _y, int32_t _size, cv::Mat& _patch)
+  {
+    cv::Rect roi(_x, _y, _size, _size);
+    cv::Rect inside = roi & cv::Rect(0, 0, _gray.cols, _gray.rows);
+    if (inside == roi)
+    {
+      _gray(roi).copyTo(_patch);
+      return;
+    }
+
+    _patch.create(_size, _size, _gray.type() );
+    _patch.setTo(cv::Scalar::all(0) );
+    if (inside.area() > 0)
+    {
+      cv::Mat dst = _patch(inside - roi.tl() );
+      _gray(inside).copyTo(dst);
+    }
+  }
+
+  /*!
+   \c rcr::HogTransform without its per sample image copies. rcr converts the image to gray for
+   every sample, and copies the whole image with a border for every patch near the border. Here the
+   gray image is made once per image in a \c FeatureContext, and border patches are cut from it with
+   zeros outside. Only that part is shared by the samples of an image: patches are resized to a fixed
+   size before HOG, so gradients, orientations and histograms still run once per sample.
+
+   Descriptors are meant to equal rcr's, patch sizes follow \c Helen::rcrInterEyeDistance. Training
+   keeps \c rcr::HogTransform until tests/hogfeatures has shown them bit equal, since any difference
+   would go into the trained model.
+
+   Landmark rows must be in Helen layout, see \c Helen::interEyeDistance. Calls are thread safe.
+   */
+  class HogFeatures
+  {
+  public:
+    HogFeatures(const std::vector<cv::Mat>& _images, const std::vector<rcr::HoGParam>& _params, uint32_t _numThreads = 0)
+      : m_contexts(_images.size() )
+      , m_params(_params)
+    {
+      X::parallelFor(uint32_t(_images.size()), _numThreads, [&](uint32_t, uint32_t _ii)
+      {
+        m_contexts[_ii] = makeFeatureContext(_images[_ii]);
+      } );
+    }
+
+    /*!
+     Descriptor of landmarks \c _parameters on image \c _trainingIndex: HOG cells of every landmark
+     patch, landmark after landmark, in rcr order, followed by a bias of 1.
+
+     @param _parameters      One landmark row.
+     @param _regressorLevel  Cascade level, selects HOG parameters.
+     */
+    cv::Mat operator()(cv::Mat _parameters, size_t _regressorLevel, int _trainingIndex = 0) const
+    {
+      if (2 * Helen::kNumLandmarks != _parameters.cols || CV_32F != _parameters.type() )
+      {
+        throw std::runtime_error("HOG features need one float row of Helen landmarks.");
+      }
+
+      const rcr::HoGParam& param = m_params[_regressorLevel];
+      const cv::Mat& gray = m_contexts[_trainingIndex].gray;
+      const uint32_t num_lmks = Helen::kNumLandmarks;
+      const float* xs = _parameters.ptr<float>();
+      const float* ys = xs + num_lmks;
+      int32_t patch_half = int32_t(std::round(param.relative_patch_size * Helen::rcrInterEyeDistance(xs, ys) / 2) );
+      int32_t fixed_size = param.num_cells * param.cell_size;
+
+      std::unique_ptr<VlHog, void(*)(VlHog*)> hog(vl_hog_new(param.vlhog_variant, param.num_bins, false), &vl_hog_delete);
+      cv::Mat patch, resized, patch_float, descriptors;
+      std::vector<float> cells;
+      uint32_t width = 0, height = 0, dims = 0;
+      for (uint32_t ii = 0; ii < num_lmks; ++ii)
+      {
+        extractPatch(gray, cvRound(xs[ii]) - patch_half, cvRound(ys[ii]) - patch_half, 2 * patch_half, patch);
+        cv::resize(patch, resized, cv::Size(fixed_size, fixed_size) );
+        resized.convertTo(patch_float, CV_32F);
+        vl_hog_put_image(hog.get(), patch_float.ptr<float>(), patch_float.cols, patch_float.rows, 1, param.cell_size);
+
+        if (0 == ii)
+        {
+          width = uint32_t(vl_hog_get_width(hog.get()) );
+          height = uint32_t(vl_hog_get_height(hog.get()) );
+          dims = uint32_t(vl_hog_get_dimension(hog.get()) );
+          cells.resize(width * height * dims);
+          descriptors.create(1, int(num_lmks * cells.size() + 1), CV_32F);
+        }
+        vl_hog_extract(hog.get(), cells.data() );
+
+        // vl_hog gives a row major plane per dimension, rcr stacks each plane column major.
+        float* out = descriptors.ptr<float>() + ii * cells.size();
+        for (uint32_t dd = 0; dd < dims; ++dd)
+        {
+          const float* plane = cells.data() + dd * width * height;
+          for (uint32_t xx = 0; xx < width; ++xx)
+            for (uint32_t yy = 0; yy < height; ++yy)
+              *out++ = plane[yy * width + xx];
+        }
+      }
+      descriptors.ptr<float>()[descriptors.cols - 1] = 1.f;
+      return descriptors;
+    }
+
+  private:
+    std::vector<FeatureContext>   m_contexts;
+    std::vector<rcr::HoGParam>    m_params;
+  };
+
+}
+
+#endif  //SDM_HOGFEATURES_H_HEADER_GUARD
@@ -22,6 +22,7 @@
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgcodecs.hpp>
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
@@ -32,16 +33,31 @@
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <iostream>
 #include <fstream>
 #include <utility>
 #include <random>
 #include <cassert>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
 
 #include "rcr/landmark.hpp"
 #include "rcr/model.hpp"
 
 #include "xmath.hpp"
+#include "xio.hpp"
+#include "xthread.hpp"
+#include "xaio.hpp"
+#include "xcache.hpp"
+#include "xjpeg.hpp"
+#include "helen.hpp"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -89,8 +105,282 @@ namespace SDM
     }
     return std::make_pair(name, landmarks);
   }
+
+  /// Immutable table of landmark names, shared by every sample of a dataset.
+  using LandmarkNames = std::shared_ptr<const std::vector<std::string>>;
   
+  /*!
+   Names "1", "2", ... "_num" in annotation order. The Helen 194 table is formatted once and shared
+   by all parsers and datasets.
+   
+   @return  Landmark names.
+   */
+  inline LandmarkNames numberedLandmarkNames(uint32_t _num)
+  {
+    auto make = [](uint32_t _n)
+    {
+      std::shared_ptr<std::vector<std::string>> names = std::make_shared<std::vector<std::string>>();
+      for (uint32_t ii = 1; ii <= _n; ++ii)
+        names->emplace_back(std::to_string(ii) );
+      return LandmarkNames(names);
+    };
+    static const LandmarkNames helen = make(Helen::kNumLandmarks);
+    return Helen::kNumLandmarks == _num ? helen : make(_num);
+  }
   
+  /// Names of landmarks in Helen annotation order, "1", "2", ... "194".
+  inline const std::vector<std::string>& helenLandmarkNames()
+  {
+    return *numberedLandmarkNames(Helen::kNumLandmarks);
+  }
+  
+  /*!
+   Landmarks of a dataset as structure of arrays. Sample i is row i of one contiguous float matrix
+   laid out x_1 ... x_n, y_1 ... y_n, the row layout of rcr landmark matrices, and all samples share
+   one name table. Shape math runs over plain float arrays; convert with \c toCollection only where
+   rcr wants a \c rcr::LandmarkCollection.
+   */
+  class LandmarkSet
+  {
+  public:
+    /*!
+     @param _names      Landmark names, their number is the number of landmarks of every sample.
+     @param _numSamples Number of samples, coordinates are zero.
+     */
+    explicit LandmarkSet(const LandmarkNames& _names = numberedLandmarkNames(Helen::kNumLandmarks), uint32_t _numSamples = 0)
+      : m_names(_names)
+      , m_numLandmarks(uint32_t(_names->size()))
+      , m_coords(size_t(_numSamples) * 2 * m_numLandmarks, 0.f)
+    {
+    }
+    
+    /// Number of samples.
+    uint32_t size() const { return 0 == m_numLandmarks ? 0 : uint32_t(m_coords.size() / (2 * m_numLandmarks)); }
+    
+    bool empty() const { return m_coords.empty(); }
+    
+    /// Number of landmarks per sample.
+    uint32_t numLandmarks() const { return m_numLandmarks; }
+    
+    const LandmarkNames& getNames() const { return m_names; }
+    
+    void resize(uint32_t _numSamples) { m_coords.resize(size_t(_numSamples) * 2 * m_numLandmarks, 0.f); }
+    void reserve(uint32_t _numSamples) { m_coords.reserve(size_t(_numSamples) * 2 * m_numLandmarks); }
+    void clear() { m_coords.clear(); }
+    
+    /// All coordinates, \c size() rows of 2n floats.
+    float* data() { return m_coords.data(); }
+    const float* data() const { return m_coords.data(); }
+    
+    /// x coordinates of \c _sample, followed by its y coordinates.
+    float* x(uint32_t _sample) { return m_coords.data() + size_t(_sample) * 2 * m_numLandmarks; }
+    const float* x(uint32_t _sample) const { return m_coords.data() + size_t(_sample) * 2 * m_numLandmarks; }
+    
+    float* y(uint32_t _sample) { return x(_sample) + m_numLandmarks; }
+    const float* y(uint32_t _sample) const { return x(_sample) + m_numLandmarks; }
+    
+    cv::Vec2f point(uint32_t _sample, uint32_t _landmark) const
+    {
+      return cv::Vec2f(x(_sample)[_landmark], y(_sample)[_landmark]);
+    }
+    
+    /*!
+     Row of \c _sample without copy, valid until the set is resized.
+     
+     @return  1 x 2n CV_32F row x_1 ... x_n, y_1 ... y_n.
+     */
+    cv::Mat row(uint32_t _sample) const
+    {
+      return cv::Mat(1, int(2 * m_numLandmarks), CV_32F, (void*)x(_sample));
+    }
+    
+    /// Overwrite \c _sample with 2n floats x_1 ... x_n, y_1 ... y_n.
+    void assign(uint32_t _sample, const float* _row)
+    {
+      std::copy(_row, _row + 2 * m_numLandmarks, x(_sample));
+    }
+    
+    /// Overwrite \c _sample, \c _landmarks must have \c numLandmarks() points.
+    void assign(uint32_t _sample, const rcr::LandmarkCollection<cv::Vec2f>& _landmarks)
+    {
+      if (_landmarks.size() != m_numLandmarks)
+      {
+        throw std::runtime_error("Number of landmarks not matched.");
+      }
+      float* xs = x(_sample);
+      float* ys = y(_sample);
+      for (uint32_t jj = 0; jj < m_numLandmarks; ++jj)
+      {
+        xs[jj] = _landmarks[jj].coordinates[0];
+        ys[jj] = _landmarks[jj].coordinates[1];
+      }
+    }
+    
+    /// Append sample \c _sample of \c _other, which must have the same number of landmarks.
+    void append(const LandmarkSet& _other, uint32_t _sample)
+    {
+      if (_other.m_numLandmarks != m_numLandmarks)
+      {
+        throw std::runtime_error("Number of landmarks not matched.");
+      }
+      m_coords.insert(m_coords.end(), _other.x(_sample), _other.x(_sample) + 2 * m_numLandmarks);
+    }
+    
+    /// Append \c _landmarks as a new sample.
+    void append(const rcr::LandmarkCollection<cv::Vec2f>& _landmarks)
+    {
+      resize(size() + 1);
+      assign(size() - 1, _landmarks);
+    }
+    
+    /// Landmarks of \c _sample with names, for rcr interfaces.
+    rcr::LandmarkCollection<cv::Vec2f> toCollection(uint32_t _sample) const
+    {
+      rcr::LandmarkCollection<cv::Vec2f> landmarks(m_numLandmarks);
+      const float* xs = x(_sample);
+      const float* ys = y(_sample);
+      for (uint32_t jj = 0; jj < m_numLandmarks; ++jj)
+      {
+        landmarks[jj].name = (*m_names)[jj];
+        landmarks[jj].coordinates = cv::Vec2f(xs[jj], ys[jj]);
+      }
+      return landmarks;
+    }
+    
+  private:
+    LandmarkNames       m_names;
+    uint32_t            m_numLandmarks;
+    std::vector<float>  m_coords;
+  };
+
+  namespace detail
+  {
+    inline bool isBlank(char _c)
+    {
+      return ' ' == _c || '\t' == _c || '\r' == _c || '\v' == _c || '\f' == _c;
+    }
+
+    inline const char* skipBlank(const char* _ptr, const char* _end)
+    {
+      while (_ptr != _end && isBlank(*_ptr) ) ++_ptr;
+      return _ptr;
+    }
+
+    /// Parse float in [_ptr, _end), strtof will never cross _end since a line break ends a number.
+    inline bool parseFloat(const char*& _ptr, const char* _end, float& _value)
+    {
+      _ptr = skipBlank(_ptr, _end);
+      if (_ptr == _end)
+        return false;
+      char* next = NULL;
+      _value = std::strtof(_ptr, &next);
+      if (next == _ptr || next > _end)
+        return false;
+      _ptr = next;
+      return true;
+    }
+
+    /// Skip one whitespace delimited token, as `operator>>(std::string&)` does.
+    inline bool skipToken(const char*& _ptr, const char* _end)
+    {
+      _ptr = skipBlank(_ptr, _end);
+      if (_ptr == _end)
+        return false;
+      while (_ptr != _end && !isBlank(*_ptr) ) ++_ptr;
+      return true;
+    }
+  }
+
+  /*!
+   Parse Helen annotation from text in memory. Same format and coordinates as \c readHelenLandmarks,
+   but coordinates are converted in place, there is no heap allocation per line.
+
+   @param _text     Annotation text, \c _text[_size] must be '\0'.
+   @param _size     Text size in bytes.
+   @param _points   Output points, cleared before parsing. Reuse it to keep its capacity.
+   @return  Name of the annotated image.
+   */
+  inline std::string parseHelenPoints(const char* _text, size_t _size, std::vector<cv::Vec2f>& _points)
+  {
+    assert('\0' == _text[_size]);
+    const char* end = _text + _size;
+    const char* eol = std::find(_text, end, '\n');
+
+    // Like readHelenLandmarks, drop the last character of the name line, the '\r' of Helen files.
+    const char* name_end = eol;
+    if (name_end != _text)
+      --name_end;
+    std::string name(_text, name_end);
+
+    _points.clear();
+    _points.reserve(Helen::kNumLandmarks);
+
+    for (const char* line = eol; line != end; line = eol)
+    {
+      line += 1; // skip '\n'
+      if (line == end)
+        break;
+      eol = std::find(line, end, '\n');
+
+      cv::Vec2f point;
+      const char* ptr = line;
+      if (!(detail::parseFloat(ptr, eol, point[0])
+            && detail::skipToken(ptr, eol)
+            && detail::parseFloat(ptr, eol, point[1]) ) )
+        throw std::runtime_error(std::string("Landmark format error while parsing the line " + std::string(line, eol) ) );
+      // Matlab convention of 1 being the first index, see readHelenLandmarks.
+      _points.emplace_back(point[0] - 1.0f, point[1] - 1.0f);
+    }
+    return name;
+  }
+
+  /*!
+   \c parseHelenPoints into named landmarks, same results as \c readHelenLandmarks.
+
+   @param _landmarks  Output landmarks, cleared before parsing.
+   @return  Name of the annotated image.
+   */
+  inline std::string parseHelenLandmarks(const char* _text, size_t _size, rcr::LandmarkCollection<cv::Vec2f>& _landmarks)
+  {
+    const std::vector<std::string>& names = helenLandmarkNames();
+    std::vector<cv::Vec2f> points;
+    std::string name = parseHelenPoints(_text, _size, points);
+    _landmarks.resize(points.size());
+    for (uint32_t jj = 0; jj < points.size(); ++jj)
+    {
+      _landmarks[jj].name = jj < names.size() ? names[jj] : std::to_string(jj + 1);
+      _landmarks[jj].coordinates = points[jj];
+    }
+    return name;
+  }
+
+  /*!
+   Fast version of \c readHelenLandmarks. The whole file is read into \c _buffer at once and parsed
+   with \c parseHelenLandmarks.
+
+   @param _filename Annotation file.
+   @param _buffer   File buffer, reuse it across calls to avoid allocation.
+   @return  Image name and landmarks.
+   */
+  inline LandmarksInfo readHelenLandmarksFast(const std::string& _filename, std::vector<char>& _buffer)
+  {
+    int64_t size = X::readFile(_filename.c_str(), _buffer);
+    if (size < 0)
+    {
+      throw std::runtime_error(std::string("Could not open landmark file: " + _filename));
+    }
+    LandmarksInfo info;
+    info.first = parseHelenLandmarks(_buffer.data(), size_t(size), info.second);
+    return info;
+  }
+
+  inline LandmarksInfo readHelenLandmarksFast(const std::string& _filename)
+  {
+    std::vector<char> buffer;
+    return readHelenLandmarksFast(_filename, buffer);
+  }
+
+
   /*!
    Interface class of data io.
    */
@@ -105,12 +395,35 @@ namespace SDM
      */
     virtual const std::vector<cv::Mat>& getData() = 0;
     
+    /*!
+     Get one image, thread safe. Implementations may keep only part of the images in memory,
+     the default one returns \c getData()[_index].
+     
+     @return  Image.
+     */
+    virtual cv::Mat getImage(uint32_t _index) { return getData()[_index]; }
+    
+    /*!
+     Get the part of image \c _index covering \c _roi, thread safe. Implementations reading encoded
+     images decode only that part when they can, the default one crops \c getImage(_index).
+     
+     @param _roi  Region of the image, set to the region actually returned, which may be clipped
+                  or wider.
+     @return  Region, empty if the image could not be read or \c _roi is outside of it.
+     */
+    virtual cv::Mat getImageRegion(uint32_t _index, cv::Rect& _roi)
+    {
+      cv::Mat image = getImage(_index);
+      _roi &= cv::Rect(0, 0, image.cols, image.rows);
+      return _roi.empty() ? cv::Mat() : image(_roi).clone();
+    }
+    
     /*!
      Get landmarks of corresponding images.
      
      @return  Landmarks.
      */
-    virtual const std::vector<rcr::LandmarkCollection<cv::Vec2f>>& getLandmarks() = 0;
+    virtual const LandmarkSet& getLandmarks() = 0;
     
     /*!
      Get filenames of corresponding images.
@@ -122,77 +435,629 @@ namespace SDM
   };
   
   /*!
-   IO implement for read Helen 194 dataset.
+   How images are decoded. A reduced JPEG decode lets libjpeg scale DCT blocks, it costs a fraction
+   of a full decode and the image takes 1 / reduction^2 of the memory, grayscale another third.
    */
-  class HelenIO : public IData
+  struct LoadPolicy
   {
-  public:
+    LoadPolicy()
+      : grayscale(false)
+      , reduction(1)
+    {
+    }
+    
+    bool      grayscale;
+    uint32_t  reduction;  //!< Downscale factor, 1, 2, 4 or 8.
     
-    struct EyeId
+    /// Flags of \c cv::imread and \c cv::imdecode implementing the policy.
+    int imreadFlags() const
     {
-      uint16_t inCorner;
-      uint16_t outCorner;
-    };
+      switch (reduction)
+      {
+        case 1: return grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+        case 2: return grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+        case 4: return grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+        case 8: return grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+        default: throw std::runtime_error("Image reduction must be 1, 2, 4 or 8.");
+      }
+    }
+  };
+  
+  /*!
+   Move landmarks from an image reduced \c _from times to the same image reduced \c _to times.
+   Pixel centers are mapped onto each other, like \c cv::resize does.
+   */
+  inline void rescaleLandmarks(LandmarkSet& _landmarks, uint32_t _from, uint32_t _to)
+  {
+    float ratio = float(_from) / float(_to);
+    float offset = 0.5f * ratio - 0.5f;
+    float* coords = _landmarks.data();
+    size_t num = size_t(_landmarks.size()) * 2 * _landmarks.numLandmarks();
+    for (size_t ii = 0; ii < num; ++ii)
+      coords[ii] = coords[ii] * ratio + offset;
+  }
+  
+  /// Bounding box of landmarks of \c _sample.
+  inline cv::Rect landmarkBounds(const LandmarkSet& _landmarks, uint32_t _sample)
+  {
+    uint32_t num = _landmarks.numLandmarks();
+    if (0 == num)
+      return cv::Rect();
+    const float* xs = _landmarks.x(_sample);
+    const float* ys = _landmarks.y(_sample);
+    int32_t x = int32_t(std::floor(*std::min_element(xs, xs + num)));
+    int32_t y = int32_t(std::floor(*std::min_element(ys, ys + num)));
+    int32_t right = int32_t(std::ceil(*std::max_element(xs, xs + num)));
+    int32_t bottom = int32_t(std::ceil(*std::max_element(ys, ys + num)));
+    return cv::Rect(x, y, right - x + 1, bottom - y + 1);
+  }
+  
+  /*!
+   Decode the part of an encoded image covering \c _roi. JPEGs are decoded by region with
+   \c X::decodeJpegRegion, anything else falls back to a full decode and a crop.
+   
+   @param _data   Image file bytes.
+   @param _size   Size of \c _data.
+   @param _roi    Region in coordinates of the image decoded with \c _policy. Set to the region
+                  actually decoded, which may be clipped or wider.
+   @param _policy Decode policy.
+   @return  Decoded region, empty if the image could not be decoded.
+   */
+  inline cv::Mat decodeImageRegion(const uint8_t* _data, size_t _size, cv::Rect& _roi, const LoadPolicy& _policy = LoadPolicy())
+  {
+    cv::Mat region;
+    if (X::decodeJpegRegion(_data, _size, _roi, _policy.grayscale, _policy.reduction, region))
+      return region;
     
-    HelenIO(fs::path _imgDir, fs::path _lmkDir)
+    cv::Mat img = cv::imdecode(cv::Mat(1, int(_size), CV_8U, (void*)_data), _policy.imreadFlags());
+    _roi &= cv::Rect(0, 0, img.cols, img.rows);
+    if (_roi.empty())
+      return cv::Mat();
+    return img(_roi).clone();
+  }
+  
+  /*!
+   Decode images on worker threads into a vector indexed like the given files. Files are read
+   by \c X::FileReader with many reads in flight and started in order, so image i is usually
+   ready before image i + 1 and consumers can start on first images while later ones are still
+   read and decoded.
+   */
+  class ImageDecoder
+  {
+  public:
+    /*!
+     Start decoding.
+     
+     @param _files      Image files.
+     @param _numThreads Decode workers, 0 means one per hardware thread.
+     @param _flags      Flags of \c cv::imdecode.
+     */
+    ImageDecoder(const std::vector<fs::path>& _files, uint32_t _numThreads, int _flags = cv::IMREAD_COLOR)
+      : m_images(_files.size())
+      , m_ready(_files.size(), 0)
+      , m_numReady(0)
+      , m_stop(false)
+      , m_flags(_flags)
     {
-      // Landmarks id assign.
-      m_leftEye.outCorner = 144;
-      m_leftEye.inCorner = 134;
+      std::vector<std::string> files;
+      files.reserve(_files.size());
+      for (auto& file : _files)
+        files.emplace_back(file.string());
+      m_reader.reset(new X::FileReader(files) );
       
-      m_rightEye.inCorner = 114;
-      m_rightEye.outCorner = 124;
+      uint32_t num_threads = std::min<size_t>(X::numThreads(_numThreads), _files.size());
+      for (uint32_t tt = 0; tt < num_threads; ++tt)
+        m_threads.emplace_back(&ImageDecoder::run, this);
+    }
+    
+    ~ImageDecoder()
+    {
+      m_stop = true;
+      for (auto& thread : m_threads)
+        thread.join();
+    }
+    
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+    
+    /*!
+     Block until image \c _index is decoded.
+     
+     @return  Decoded image, empty if it could not be read.
+     */
+    const cv::Mat& wait(uint32_t _index)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_decoded.wait(lock, [this, _index]{ return 0 != m_ready[_index]; });
+      return m_images[_index];
+    }
+    
+    /*!
+     Drop decoded image \c _index once it is decoded, to free its memory.
+     */
+    void release(uint32_t _index)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_decoded.wait(lock, [this, _index]{ return 0 != m_ready[_index]; });
+      m_images[_index].release();
+    }
+    
+    /*!
+     Block until all images are decoded.
+     
+     @return  Images in file order.
+     */
+    const std::vector<cv::Mat>& waitAll()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_decoded.wait(lock, [this]{ return m_numReady == m_images.size(); });
+      return m_images;
+    }
+    
+  private:
+    void run()
+    {
+      X::FileData file;
+      while (!m_stop && m_reader->next(file))
+      {
+        cv::Mat img;
+        if (0 < file.size)
+          img = cv::imdecode(cv::Mat(1, int(file.size), CV_8U, file.data.data()), m_flags);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_images[file.index] = img;
+        m_ready[file.index] = 1;
+        ++m_numReady;
+        m_decoded.notify_all();
+      }
+    }
+    
+    std::unique_ptr<X::FileReader>  m_reader;
+    std::vector<cv::Mat>      m_images;
+    std::vector<uint8_t>      m_ready;
+    size_t                    m_numReady;
+    std::atomic<bool>         m_stop;
+    int                       m_flags;
+    std::mutex                m_mutex;
+    std::condition_variable   m_decoded;
+    std::vector<std::thread>  m_threads;
+  };
+  
+  /*!
+   Counters of \c ImageCache. Decoded tier counts every \c get, compressed tier counts decoded misses.
+   */
+  struct ImageCacheStats
+  {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t compressedHits;
+    uint64_t compressedMisses;
+    uint64_t compressedEvictions;
+    size_t   bytes;             //!< Decoded bytes cached.
+    size_t   compressedBytes;   //!< Compressed bytes cached.
+  };
+  
+  /*!
+   Thread safe, memory bounded random access to images. Two LRU tiers: decoded images, and
+   compressed file bytes decoded on demand. Files are read from disk on a miss of both tiers.
+   */
+  class ImageCache
+  {
+  public:
+    /*!
+     @param _files              Image files.
+     @param _maxBytes           Budget of decoded images in bytes.
+     @param _maxCompressedBytes Budget of compressed file bytes, 0 disables the compressed tier.
+     @param _flags              Flags of \c cv::imread.
+     */
+    ImageCache(const std::vector<fs::path>& _files, size_t _maxBytes, size_t _maxCompressedBytes = 0, int _flags = cv::IMREAD_COLOR)
+      : m_files(_files)
+      , m_decoded(_maxBytes)
+      , m_compressed(_maxCompressedBytes)
+      , m_hits(0)
+      , m_misses(0)
+      , m_compressedHits(0)
+      , m_compressedMisses(0)
+      , m_flags(_flags)
+    {
+    }
+    
+    /*!
+     Get image \c _index. Decoding runs outside the lock, so several threads can decode at once.
+     
+     @return  Image sharing data with the cache, empty if it could not be read.
+     */
+    cv::Mat get(uint32_t _index)
+    {
+      Bytes bytes;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (cv::Mat* img = m_decoded.find(_index))
+        {
+          ++m_hits;
+          return *img;
+        }
+        ++m_misses;
+        
+        if (0 != m_compressed.capacity())
+        {
+          if (Bytes* found = m_compressed.find(_index))
+          {
+            ++m_compressedHits;
+            bytes = *found;
+          }
+          else
+          {
+            ++m_compressedMisses;
+          }
+        }
+      }
       
-      m_innerMouth = X::range<uint16_t>(86, 113);
-      m_outerMouth = X::range<uint16_t>(58, 85);
+      if (0 != m_compressed.capacity() && !bytes)
+      {
+        bytes = readBytes(m_files[_index]);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_compressed.insert(_index, bytes, bytes->size());
+      }
       
-      //
-      std::map<std::string, rcr::LandmarkCollection<cv::Vec2f>>  landmarks;
+      cv::Mat img = bytes ? cv::imdecode(*bytes, m_flags) : cv::imread(m_files[_index].string(), m_flags);
       
-      // Get all the filenames in the given directory:
-      fs::directory_iterator end_itr;
-      for (fs::directory_iterator i(_imgDir); i != end_itr; ++i)
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_decoded.insert(_index, img, img.total() * img.elemSize());
+      return img;
+    }
+    
+    ///
+    ImageCacheStats stats() const
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ImageCacheStats stats;
+      stats.hits = m_hits;
+      stats.misses = m_misses;
+      stats.evictions = m_decoded.numEvictions();
+      stats.compressedHits = m_compressedHits;
+      stats.compressedMisses = m_compressedMisses;
+      stats.compressedEvictions = m_compressed.numEvictions();
+      stats.bytes = m_decoded.cost();
+      stats.compressedBytes = m_compressed.cost();
+      return stats;
+    }
+    
+  private:
+    using Bytes = std::shared_ptr<const std::vector<uchar>>;
+    
+    static Bytes readBytes(const fs::path& _file)
+    {
+      std::vector<char> buffer;
+      int64_t size = X::readFile(_file.string().c_str(), buffer);
+      if (size < 0)
       {
-        if (fs::is_regular_file(i->status()) && i->path().extension() == ".jpg")
-          m_filenames.emplace_back(i->path());
+        return std::make_shared<const std::vector<uchar>>();
       }
+      return std::make_shared<const std::vector<uchar>>(buffer.begin(), buffer.begin() + size);
+    }
+    
+    std::vector<fs::path>             m_files;
+    X::LruCache<uint32_t, cv::Mat>    m_decoded;
+    X::LruCache<uint32_t, Bytes>      m_compressed;
+    uint64_t                          m_hits;
+    uint64_t                          m_misses;
+    uint64_t                          m_compressedHits;
+    uint64_t                          m_compressedMisses;
+    int                               m_flags;
+    mutable std::mutex                m_mutex;
+  };
+  
+  const char     kIndexMagic[8] = { 'S', 'D', 'M', 'I', 'N', 'D', 'E', 'X' };
+  const uint32_t kIndexVersion = 3;
+  
+  /*!
+   Scanned state of a Helen style directory pair, cached on disk by \c HelenIO so that repeat runs
+   skip the directory walk and annotation parsing. Valid as long as both directory mtimes and entry
+   counts are unchanged, i.e. no file was added, removed or renamed. Counts catch changes within the
+   mtime granularity of the filesystem. Image sizes and mtimes are kept too, but only compared on
+   request since that takes a stat per image. Files edited in place are only detected by that check,
+   annotations not at all.
+   */
+  struct DatasetIndex
+  {
+    std::string           imgDir;
+    std::string           lmkDir;
+    int64_t               imgDirTime;
+    int64_t               lmkDirTime;
+    uint32_t              imgDirEntries;
+    uint32_t              lmkDirEntries;
+    std::vector<fs::path> filenames;
+    std::vector<uint64_t> fileSizes;
+    std::vector<int64_t>  fileTimes;
+    LandmarkSet           landmarks;
+  };
+  
+  namespace detail
+  {
+    template<typename Ty>
+    void writePod(std::ofstream& _out, const Ty& _value)
+    {
+      _out.write((const char*)&_value, sizeof(Ty));
+    }
+    
+    inline void writeString(std::ofstream& _out, const std::string& _str)
+    {
+      writePod(_out, uint32_t(_str.size()));
+      _out.write(_str.data(), _str.size());
+    }
+    
+    /// Bounds checked reader of a binary buffer.
+    struct BinaryReader
+    {
+      const char* ptr;
+      const char* end;
       
-      // Get all the annotations corresponding to given images.
-      for (fs::directory_iterator i(_lmkDir); i != end_itr; ++i)
+      template<typename Ty>
+      bool read(Ty& _value)
       {
-        if (fs::is_regular_file(i->status()) && i->path().extension() == ".txt")
-        {
-          LandmarksInfo lmk = readHelenLandmarks(i->path().string());
-          landmarks.insert(lmk);
-        }
+        if (size_t(end - ptr) < sizeof(Ty))
+          return false;
+        X::memCopy(&_value, ptr, sizeof(Ty));
+        ptr += sizeof(Ty);
+        return true;
       }
       
-
-      // Convert map to vector.
-      for (uint32_t i = 0; i < m_filenames.size(); ++i)
+      bool read(std::string& _str)
       {
-        auto filename = fs::basename(m_filenames[i].filename());
-        if (landmarks.end() == landmarks.find(filename))
-        {
-          throw std::runtime_error("Landmark file not exists.");
-        }
-        m_landmarks.emplace_back(landmarks[ filename ]);
+        uint32_t size;
+        if (!read(size) || size_t(end - ptr) < size)
+          return false;
+        _str.assign(ptr, size);
+        ptr += size;
+        return true;
       }
+    };
+  }
+  
+  /*!
+   Write dataset index, through a temporary file renamed in place so readers never see a partial index.
+   */
+  inline void writeDatasetIndex(const fs::path& _file, const DatasetIndex& _index)
+  {
+    fs::path tmp = _file;
+    tmp += fs::unique_path(".%%%%-%%%%");
+    {
+      std::ofstream out(tmp.string(), std::ios::binary | std::ios::trunc);
+      if (false == out.is_open())
+      {
+        throw std::runtime_error(std::string("Could not create index file: " + tmp.string()));
+      }
+      out.write(kIndexMagic, sizeof(kIndexMagic));
+      detail::writePod(out, kIndexVersion);
+      detail::writeString(out, _index.imgDir);
+      detail::writeString(out, _index.lmkDir);
+      detail::writePod(out, _index.imgDirTime);
+      detail::writePod(out, _index.lmkDirTime);
+      detail::writePod(out, _index.imgDirEntries);
+      detail::writePod(out, _index.lmkDirEntries);
+      detail::writePod(out, uint32_t(_index.filenames.size()));
+      detail::writePod(out, _index.landmarks.numLandmarks());
+      for (uint32_t ii = 0; ii < _index.filenames.size(); ++ii)
+      {
+        detail::writeString(out, _index.filenames[ii].string());
+        detail::writePod(out, _index.fileSizes[ii]);
+        detail::writePod(out, _index.fileTimes[ii]);
+      }
+      out.write((const char*)_index.landmarks.data(), _index.landmarks.size() * 2 * _index.landmarks.numLandmarks() * sizeof(float));
+      if (!out.good())
+      {
+        throw std::runtime_error(std::string("Could not write index file: " + tmp.string()));
+      }
+    }
+    fs::rename(tmp, _file);
+  }
+  
+  /*!
+   Read dataset index written by \c writeDatasetIndex.
+   
+   @return  False if the file does not exist, is corrupted or of another version.
+   */
+  inline bool readDatasetIndex(const fs::path& _file, DatasetIndex& _index)
+  {
+    std::vector<char> buffer;
+    int64_t size = X::readFile(_file.string().c_str(), buffer);
+    if (size < int64_t(sizeof(kIndexMagic)) || 0 != X::memCmp(buffer.data(), kIndexMagic, sizeof(kIndexMagic)))
+      return false;
+    
+    detail::BinaryReader reader{ buffer.data() + sizeof(kIndexMagic), buffer.data() + size };
+    uint32_t version, num_samples, num_landmarks;
+    if (!(reader.read(version) && kIndexVersion == version
+          && reader.read(_index.imgDir) && reader.read(_index.lmkDir)
+          && reader.read(_index.imgDirTime) && reader.read(_index.lmkDirTime)
+          && reader.read(_index.imgDirEntries) && reader.read(_index.lmkDirEntries)
+          && reader.read(num_samples) && reader.read(num_landmarks) ) )
+      return false;
+    
+    // A sample takes at least a name length, size, time and its landmarks, reject counts the rest of
+    // a corrupt file cannot hold before allocating for them.
+    size_t remaining = size_t(reader.end - reader.ptr);
+    size_t sample_bytes = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t) + size_t(num_landmarks) * 2 * sizeof(float);
+    if (size_t(num_landmarks) * 2 * sizeof(float) > remaining || size_t(num_samples) > remaining / sample_bytes)
+      return false;
+    
+    _index.filenames.resize(num_samples);
+    _index.fileSizes.resize(num_samples);
+    _index.fileTimes.resize(num_samples);
+    std::string filename;
+    for (uint32_t ii = 0; ii < num_samples; ++ii)
+    {
+      if (!(reader.read(filename) && reader.read(_index.fileSizes[ii]) && reader.read(_index.fileTimes[ii]) ) )
+        return false;
+      _index.filenames[ii] = filename;
+    }
+    
+    size_t coord_bytes = size_t(num_samples) * 2 * num_landmarks * sizeof(float);
+    if (size_t(reader.end - reader.ptr) != coord_bytes)
+      return false;
+    _index.landmarks = LandmarkSet(numberedLandmarkNames(num_landmarks), num_samples);
+    X::memCopy(_index.landmarks.data(), reader.ptr, coord_bytes);
+    return true;
+  }
+  
+  /*!
+   Parse Helen 194 annotation files with \c parseHelenPoints on \c _numThreads threads, while
+   \c X::FileReader keeps many reads in flight.
+   
+   @param _imageNames  Optional output, names of annotated images.
+   @return  Landmarks, in order of \c _files.
+   */
+  inline LandmarkSet readHelenLandmarksFiles(const std::vector<std::string>& _files, uint32_t _numThreads, std::vector<std::string>* _imageNames = NULL)
+  {
+    LandmarkSet landmarks(numberedLandmarkNames(Helen::kNumLandmarks), uint32_t(_files.size()));
+    std::vector<std::vector<cv::Vec2f>> points(X::numThreads(_numThreads));
+    if (NULL != _imageNames)
+      _imageNames->assign(_files.size(), std::string());
     
+    X::parallelRead(_files, _numThreads,
+                    [&](uint32_t _threadId, const X::FileData& _file)
+                    {
+                      if (_file.size < 0)
+                      {
+                        throw std::runtime_error(std::string("Could not open landmark file: " + _files[_file.index]));
+                      }
+                      std::vector<cv::Vec2f>& pts = points[_threadId];
+                      std::string name = parseHelenPoints(_file.data.data(), size_t(_file.size), pts);
+                      if (pts.size() != landmarks.numLandmarks())
+                      {
+                        throw std::runtime_error(std::string("Not a Helen 194 annotation: " + _files[_file.index]));
+                      }
+                      float* xs = landmarks.x(_file.index);
+                      float* ys = landmarks.y(_file.index);
+                      for (uint32_t jj = 0; jj < pts.size(); ++jj)
+                      {
+                        xs[jj] = pts[jj][0];
+                        ys[jj] = pts[jj][1];
+                      }
+                      if (NULL != _imageNames)
+                        (*_imageNames)[_file.index] = std::move(name);
+                    } );
+    return landmarks;
+  }
+  
+  /*!
+   Base of IO implements reading a list of image files. Derived classes fill \c m_filenames and
+   \c m_landmarks, images are decoded in background by \c ImageDecoder or through \c ImageCache.
+   */
+  class ImageFileIO : public IData
+  {
+  public:
+    
+    /*!
+     Start decoding images in background, does nothing if already started. Thread safe, the first
+     caller starts the decoder.
+     
+     @param _numThreads Decode workers, 0 means one per hardware thread.
+     */
+    void prefetch(uint32_t _numThreads)
+    {
+      std::lock_guard<std::mutex> lock(m_decoderMutex);
+      if (!m_decoder)
+        m_decoder.reset(new ImageDecoder(m_filenames, _numThreads, m_policy.imreadFlags()) );
     }
     
+    void prefetch() { prefetch(m_numThreads); }
+    
+    /*!
+     Get image \c _index, blocks until it is decoded. Starts prefetching if not started yet.
+     
+     @return  Image.
+     */
+    const cv::Mat& waitImage(uint32_t _index)
+    {
+      prefetch();
+      return m_decoder->wait(_index);
+    }
+    
+    /*!
+     Free decoded image \c _index when the caller keeps only a part of it, \c getData then holds an
+     empty image at \c _index.
+     */
+    void releaseImage(uint32_t _index)
+    {
+      ImageDecoder* decoder = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(m_decoderMutex);
+        decoder = m_decoder.get();
+      }
+      if (decoder)
+        decoder->release(_index);
+    }
     
     virtual const std::vector<cv::Mat>& getData()
     {
-      if (0 == m_images.size())
+      prefetch();
+      return m_decoder->waitAll();
+    }
+    
+    /*!
+     Keep images in a memory bounded \c ImageCache instead of decoding all of them, \c getImage
+     then goes through the cache.
+     
+     @param _maxBytes           Budget of decoded images in bytes.
+     @param _maxCompressedBytes Budget of compressed file bytes, 0 disables the compressed tier.
+     */
+    void setImageCache(size_t _maxBytes, size_t _maxCompressedBytes = 0)
+    {
+      m_cache.reset(new ImageCache(m_filenames, _maxBytes, _maxCompressedBytes, m_policy.imreadFlags()) );
+    }
+    
+    virtual cv::Mat getImage(uint32_t _index)
+    {
+      if (m_cache)
+        return m_cache->get(_index);
+      return waitImage(_index);
+    }
+    
+    /*!
+     Decode images reduced and/or grayscale, landmarks are rescaled to match. Must be set before
+     images are prefetched or cached, default is full resolution color.
+     */
+    void setLoadPolicy(const LoadPolicy& _policy)
+    {
+      if (m_decoder || m_cache)
       {
-        for (auto& file : m_filenames)
-          m_images.emplace_back(cv::imread(file.string() ) );
+        throw std::runtime_error("Load policy must be set before images are loaded.");
       }
-      return m_images;
+      _policy.imreadFlags(); // validate
+      rescaleLandmarks(m_landmarks, m_policy.reduction, _policy.reduction);
+      m_policy = _policy;
     }
     
-    virtual const std::vector<rcr::LandmarkCollection<cv::Vec2f>>& getLandmarks()
+    const LoadPolicy& getLoadPolicy() const { return m_policy; }
+    
+    /*!
+     Read and decode only the part of image \c _index covering \c _roi, e.g. a padded face box,
+     bypassing prefetch and cache. See \c decodeImageRegion.
+     
+     @param _roi  Region in coordinates of the image loaded with current policy. Set to the region
+                  actually decoded.
+     @return  Decoded region, empty if the image could not be read.
+     */
+    virtual cv::Mat getImageRegion(uint32_t _index, cv::Rect& _roi)
+    {
+      std::vector<char> buffer;
+      int64_t size = X::readFile(m_filenames[_index].string().c_str(), buffer);
+      if (size < 0)
+      {
+        _roi = cv::Rect();
+        return cv::Mat();
+      }
+      return decodeImageRegion((const uint8_t*)buffer.data(), size_t(size), _roi, m_policy);
+    }
+    
+    /// Counters of image cache, all zero if no cache is set.
+    ImageCacheStats getImageCacheStats() const
+    {
+      return m_cache ? m_cache->stats() : ImageCacheStats();
+    }
+    
+    virtual const LandmarkSet& getLandmarks()
     {
       return m_landmarks;
     }
@@ -202,24 +1067,178 @@ namespace SDM
       return m_filenames;
     }
     
-    const EyeId& getLeftEye()  { return m_leftEye; }
-    const EyeId& getRightEye() { return m_rightEye; }
-    const std::vector<uint16_t>& getInnerMouth() { return m_innerMouth; }
-    const std::vector<uint16_t>& getOuterMouth() { return m_outerMouth; }
+  protected:
+    /*!
+     @param _numThreads Threads parsing annotations and decoding images, 0 means one per hardware thread.
+     */
+    explicit ImageFileIO(uint32_t _numThreads)
+      : m_numThreads(_numThreads)
+    {
+    }
     
-  private:
-    std::vector<cv::Mat>    m_images;
+    uint32_t                m_numThreads;
+    LoadPolicy              m_policy;
+    std::mutex              m_decoderMutex;   //!< Guards start of \c m_decoder, which then stays set.
+    std::unique_ptr<ImageDecoder> m_decoder;
+    std::unique_ptr<ImageCache>   m_cache;
     std::vector<fs::path>   m_filenames;
-    std::vector<rcr::LandmarkCollection<cv::Vec2f>> m_landmarks;
+    LandmarkSet             m_landmarks;
+  };
+  
+  /*!
+   IO implement for read Helen 194 dataset.
+   */
+  class HelenIO : public ImageFileIO
+  {
+  public:
     
-
+    /// Landmark indices of eye corners, see \c Helen.
+    using EyeId = Helen::EyeCorners;
     
-    EyeId                 m_leftEye;
-    EyeId                 m_rightEye;
-    std::vector<uint16_t> m_innerMouth;
-    std::vector<uint16_t> m_outerMouth;
+    /*!
+     Scan images and annotations of Helen dataset.
+     
+     @param _imgDir     Directory of .jpg images.
+     @param _lmkDir     Directory of .txt annotations.
+     @param _numThreads Threads parsing annotations and decoding images, 0 means one per hardware thread.
+     @param _indexFile  Optional \c DatasetIndex cache. If it is still valid for both directories the scan
+                        is skipped, otherwise it is rewritten after the scan.
+     @param _verifyIndex  Also compare size and mtime of every image with the index, a stat per image.
+     */
+    HelenIO(fs::path _imgDir, fs::path _lmkDir, uint32_t _numThreads = 1, fs::path _indexFile = fs::path(), bool _verifyIndex = false)
+      : ImageFileIO(_numThreads)
+      , m_indexHit(false)
+    {
+      auto begin = std::chrono::steady_clock::now();
+      
+      // Sample directory times before scanning, so changes during the scan invalidate the index.
+      DatasetIndex index;
+      index.imgDir = fs::absolute(_imgDir).string();
+      index.lmkDir = fs::absolute(_lmkDir).string();
+      index.imgDirTime = fs::last_write_time(_imgDir);
+      index.lmkDirTime = fs::last_write_time(_lmkDir);
+      index.imgDirEntries = countEntries(_imgDir);
+      index.lmkDirEntries = countEntries(_lmkDir);
+      
+      if (!_indexFile.empty())
+        m_indexHit = loadIndex(_indexFile, index, _verifyIndex);
+      
+      if (!m_indexHit)
+      {
+        scan(_imgDir, _lmkDir);
+        if (!_indexFile.empty())
+          saveIndex(_indexFile, index);
+      }
+      
+      m_startupSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    
+    
+    /// Seconds spent in constructor scanning or loading index.
+    double getStartupSeconds() const { return m_startupSeconds; }
+    
+    /// Whether constructor loaded a valid index instead of scanning.
+    bool isIndexHit() const { return m_indexHit; }
+    
+    static constexpr EyeId getLeftEye()  { return Helen::kLeftEye; }
+    static constexpr EyeId getRightEye() { return Helen::kRightEye; }
+    static constexpr Helen::Range getInnerMouth() { return Helen::kInnerMouth; }
+    static constexpr Helen::Range getOuterMouth() { return Helen::kOuterMouth; }
+    
+  private:
+    /// Entries of \c _dir, read from the directory without a stat per entry.
+    static uint32_t countEntries(const fs::path& _dir)
+    {
+      return uint32_t(std::distance(fs::directory_iterator(_dir), fs::directory_iterator()) );
+    }
+    
+    /// Walk both directories and parse annotations.
+    void scan(const fs::path& _imgDir, const fs::path& _lmkDir)
+    {
+      // Get all the filenames in the given directory:
+      fs::directory_iterator end_itr;
+      for (fs::directory_iterator i(_imgDir); i != end_itr; ++i)
+      {
+        if (fs::is_regular_file(i->status()) && i->path().extension() == ".jpg")
+          m_filenames.emplace_back(i->path());
+      }
+      
+      std::vector<std::string> lmk_files;
+      for (fs::directory_iterator i(_lmkDir); i != end_itr; ++i)
+      {
+        if (fs::is_regular_file(i->status()) && i->path().extension() == ".txt")
+          lmk_files.emplace_back(i->path().string());
+      }
+      
+      // Get all the annotations corresponding to given images.
+      std::vector<std::string> names;
+      LandmarkSet landmarks = readHelenLandmarksFiles(lmk_files, m_numThreads, &names);
+      
+      // Hash join annotations to images, first annotation of a name wins.
+      std::unordered_map<std::string, uint32_t> lmk_index;
+      lmk_index.reserve(names.size());
+      for (uint32_t i = 0; i < names.size(); ++i)
+        lmk_index.emplace(names[i], i);
+      
+      m_landmarks = LandmarkSet(landmarks.getNames(), uint32_t(m_filenames.size()));
+      for (uint32_t i = 0; i < m_filenames.size(); ++i)
+      {
+        auto found = lmk_index.find(fs::basename(m_filenames[i].filename()));
+        if (lmk_index.end() == found)
+        {
+          throw std::runtime_error("Landmark file not exists.");
+        }
+        m_landmarks.assign(i, landmarks.x(found->second));
+      }
+    }
     
+    /// Take filenames and landmarks from index file if it matches directories, times and entry counts
+    /// of \c _current, and with \c _verifyFiles sizes and times of all images.
+    bool loadIndex(const fs::path& _indexFile, const DatasetIndex& _current, bool _verifyFiles)
+    {
+      DatasetIndex index;
+      if (!readDatasetIndex(_indexFile, index)
+          || index.imgDir != _current.imgDir || index.lmkDir != _current.lmkDir
+          || index.imgDirTime != _current.imgDirTime || index.lmkDirTime != _current.lmkDirTime
+          || index.imgDirEntries != _current.imgDirEntries || index.lmkDirEntries != _current.lmkDirEntries)
+        return false;
+      
+      boost::system::error_code error;
+      for (uint32_t ii = 0; _verifyFiles && ii < index.filenames.size(); ++ii)
+      {
+        const fs::path& file = index.filenames[ii];
+        if (index.fileSizes[ii] != fs::file_size(file, error) || error
+            || index.fileTimes[ii] != fs::last_write_time(file, error) || error)
+          return false;
+      }
+      
+      m_filenames = std::move(index.filenames);
+      m_landmarks = std::move(index.landmarks);
+      return true;
+    }
+    
+    /// Write scanned state to index file, a failure only costs the next run a rescan.
+    void saveIndex(const fs::path& _indexFile, DatasetIndex& _index)
+    {
+      _index.filenames = m_filenames;
+      _index.landmarks = m_landmarks;
+      try
+      {
+        for (auto& file : m_filenames)
+        {
+          _index.fileSizes.emplace_back(fs::file_size(file));
+          _index.fileTimes.emplace_back(fs::last_write_time(file));
+        }
+        writeDatasetIndex(_indexFile, _index);
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << e.what() << std::endl;
+      }
+    }
     
+    bool                  m_indexHit;
+    double                m_startupSeconds;
   };
 
 }
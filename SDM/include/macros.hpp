@@ -30,6 +30,9 @@
 #define X_UNLIKELY(_x)    (_x)
 #define X_LIKELY(_x)      (_x)
 
+/// Pointer does not alias other pointers of the call, lets compilers vectorise loops over it.
+#define X_RESTRICT        __restrict
+
 #if X_DEBUG
 #     define X_CHECK _X_CHECK
 #     define X_TRACE _X_TRACE
@@ -0,0 +1,129 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_MANIFEST_H_HEADER_GUARD
+#define SDM_MANIFEST_H_HEADER_GUARD
+
+#include "iodata.hpp"
+
+namespace SDM
+{
+
+  /*!
+   Selection of manifest entries. Entry \c e belongs to shard \c e % numShards, so shards are disjoint
+   and cover the manifest. Within a shard entries \c offset, \c offset + \c stride, ... are kept, up to
+   \c maxSamples of them.
+   */
+  struct ManifestOptions
+  {
+    ManifestOptions()
+      : shard(0)
+      , numShards(1)
+      , stride(1)
+      , offset(0)
+      , maxSamples(0)
+      , numThreads(1)
+    {
+    }
+
+    uint32_t shard;       //!< Shard k of numShards, in [0, numShards).
+    uint32_t numShards;
+    uint32_t stride;      //!< Keep every stride-th entry of the shard.
+    uint32_t offset;      //!< First entry of the shard kept.
+    uint32_t maxSamples;  //!< 0 means no limit.
+    uint32_t numThreads;  //!< Threads parsing annotations and decoding images, 0 means one per hardware thread.
+  };
+
+  /*!
+   IO implement for read a manifest file, one sample per line:
+
+     <image path> <annotation path>
+
+   Paths are separated by whitespace and relative ones are resolved against the manifest directory.
+   Empty lines and lines starting with '#' are skipped. Only selected entries are touched on disk.
+   */
+  class ManifestIO : public ImageFileIO
+  {
+  public:
+
+    ManifestIO(const fs::path& _manifest, const ManifestOptions& _options = ManifestOptions())
+      : ImageFileIO(_options.numThreads)
+    {
+      if (0 == _options.numShards || _options.shard >= _options.numShards || 0 == _options.stride)
+      {
+        throw std::runtime_error("Invalid manifest shard or stride.");
+      }
+
+      std::vector<char> buffer;
+      int64_t size = X::readFile(_manifest.string().c_str(), buffer);
+      if (size < 0)
+      {
+        throw std::runtime_error(std::string("Could not open manifest file: " + _manifest.string()));
+      }
+
+      fs::path base = _manifest.parent_path();
+      std::vector<std::string> lmk_files;
+      const char* end = buffer.data() + size;
+      uint32_t entry = 0;
+      for (const char* line = buffer.data(); line < end; )
+      {
+        const char* eol = std::find(line, end, '\n');
+        std::string text = boost::algorithm::trim_copy(std::string(line, eol));
+        line = eol + 1;
+        if (text.empty() || '#' == text[0])
+          continue;
+
+        uint32_t ee = entry++;
+        if (ee % _options.numShards != _options.shard)
+          continue;
+        uint32_t kk = ee / _options.numShards;
+        if (kk < _options.offset || 0 != (kk - _options.offset) % _options.stride)
+          continue;
+        if (0 != _options.maxSamples && m_filenames.size() == _options.maxSamples)
+          break;
+
+        std::vector<std::string> fields;
+        boost::algorithm::split(fields, text, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+        if (2 != fields.size())
+        {
+          throw std::runtime_error(std::string("Manifest format error while parsing the line " + text));
+        }
+        m_filenames.emplace_back(resolve(base, fields[0]));
+        lmk_files.emplace_back(resolve(base, fields[1]).string());
+        m_entries.emplace_back(ee);
+      }
+
+      m_landmarks = readHelenLandmarksFiles(lmk_files, m_numThreads);
+    }
+
+    /// Manifest entry of every sample, counting non empty, non comment lines from 0.
+    const std::vector<uint32_t>& getEntries() const { return m_entries; }
+
+  private:
+    static fs::path resolve(const fs::path& _base, const std::string& _path)
+    {
+      fs::path path(_path);
+      return path.is_absolute() ? path : _base / path;
+    }
+
+    std::vector<uint32_t> m_entries;
+  };
+
+}
+
+#endif  //SDM_MANIFEST_H_HEADER_GUARD
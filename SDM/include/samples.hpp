@@ -0,0 +1,97 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_SAMPLES_H_HEADER_GUARD
+#define SDM_SAMPLES_H_HEADER_GUARD
+
+#include <opencv2/core/core.hpp>
+#include <stdint.h> // uint32_t
+#include <stddef.h> // size_t
+
+namespace SDM
+{
+
+  /// Training sample: a face and which draw of its initial box, 0 is the box itself and d > 0 perturbation d - 1.
+  struct TrainingSample
+  {
+    uint32_t face;
+    uint32_t draw;
+  };
+
+  /*!
+   Training samples of \c numFaces faces with \c drawsPerFace draws each, face major: sample
+   \c s is draw \c s % drawsPerFace of face \c s / drawsPerFace. The table is implicit, its size
+   does not grow with the number of perturbations, and everything per sample (box, x0 row) is
+   derived from the descriptor when needed.
+   */
+  class SampleTable
+  {
+  public:
+    SampleTable(uint32_t _numFaces = 0, uint32_t _drawsPerFace = 1)
+      : m_numFaces(_numFaces)
+      , m_drawsPerFace(_drawsPerFace)
+    {
+    }
+
+    uint32_t size() const { return m_numFaces * m_drawsPerFace; }
+    uint32_t numFaces() const { return m_numFaces; }
+    uint32_t drawsPerFace() const { return m_drawsPerFace; }
+
+    /// Descriptor of sample \c _index.
+    TrainingSample at(uint32_t _index) const
+    {
+      TrainingSample sample = { _index / m_drawsPerFace, _index % m_drawsPerFace };
+      return sample;
+    }
+
+    /// First sample of face \c _face.
+    uint32_t first(uint32_t _face) const { return _face * m_drawsPerFace; }
+
+  private:
+    uint32_t m_numFaces;
+    uint32_t m_drawsPerFace;
+  };
+
+  /*!
+   Feature transform over \c SampleTable samples, for a transform taking one image per training
+   index such as \c rcr::HogTransform. The wrapped transform holds one image per face and every
+   draw of the face reads it, instead of a copy of the image handle per sample.
+   */
+  template<typename Transform>
+  class SampleTransform
+  {
+  public:
+    SampleTransform(Transform& _transform, const SampleTable& _samples)
+      : m_transform(_transform)
+      , m_samples(_samples)
+    {
+    }
+
+    cv::Mat operator()(cv::Mat _parameters, size_t _regressorLevel, int _trainingIndex = 0)
+    {
+      return m_transform(_parameters, _regressorLevel, int(m_samples.at(uint32_t(_trainingIndex)).face));
+    }
+
+  private:
+    Transform&          m_transform;
+    const SampleTable&  m_samples;
+  };
+
+}
+
+#endif  //SDM_SAMPLES_H_HEADER_GUARD
@@ -0,0 +1,253 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_SHAPE_H_HEADER_GUARD
+#define SDM_SHAPE_H_HEADER_GUARD
+
+#include <opencv2/core/core.hpp>
+#include <cmath>
+
+#include "x.hpp"
+#include "xthread.hpp"
+
+/*
+ Batched shape kernels. A shape is a landmark row x_1 ... x_n, y_1 ... y_n and shapes of a batch
+ are contiguous rows, e.g. \c LandmarkSet::data() or a continuous CV_32F matrix. Normalisation and
+ alignment are a scale and an offset per axis, inner loops have no branches so compilers vectorise them.
+ */
+
+namespace SDM
+{
+  namespace detail
+  {
+    inline void scaleOffset(const float* X_RESTRICT _src, float* X_RESTRICT _dst, uint32_t _num, float _scale, float _offset)
+    {
+      for (uint32_t ii = 0; ii < _num; ++ii)
+        _dst[ii] = _src[ii] * _scale + _offset;
+    }
+  }
+
+  /*!
+   Move \c _num shapes into coordinates of their boxes: box center is the origin and box size the
+   unit, \c (x - cx) / width and \c (y - cy) / height.
+
+   @param _shapes       \c _num rows of \c 2 * _numLandmarks.
+   @param _boxes        Box of every shape.
+   @param _normalised   Output, \c _num rows, must not overlap \c _shapes.
+   */
+  inline void normaliseShapes(const float* _shapes, const cv::Rect* _boxes, uint32_t _num, uint32_t _numLandmarks, float* _normalised)
+  {
+    size_t row = 2 * size_t(_numLandmarks);
+    for (uint32_t ii = 0; ii < _num; ++ii)
+    {
+      const cv::Rect& box = _boxes[ii];
+      float cx = box.x + box.width / 2.f;
+      float cy = box.y + box.height / 2.f;
+      const float* src = _shapes + ii * row;
+      float* dst = _normalised + ii * row;
+      detail::scaleOffset(src, dst, _numLandmarks, 1.f / box.width, -cx / box.width);
+      detail::scaleOffset(src + _numLandmarks, dst + _numLandmarks, _numLandmarks, 1.f / box.height, -cy / box.height);
+    }
+  }
+
+  /*!
+   Place normalised shapes into boxes, \c x * width + (origin.x * width + box.x) and likewise for y.
+   Shape \c i goes into box \c i, a stride of 0 uses the same shape, or the same box, for all.
+
+   @param _shapes       Normalised rows of \c 2 * _numLandmarks.
+   @param _shapeStride  Rows between consecutive shapes, 0 or 1.
+   @param _boxes        Boxes.
+   @param _boxStride    Boxes between consecutive shapes, 0 or 1.
+   @param _num          Number of output rows.
+   @param _origin       Box relative position of the normalised origin, (0.5, 0.5) inverts \c normaliseShapes.
+   @param _aligned      Output, \c _num rows, must not overlap \c _shapes.
+   */
+  inline void alignShapes(const float* _shapes, uint32_t _shapeStride, const cv::Rect* _boxes, uint32_t _boxStride,
+                          uint32_t _num, uint32_t _numLandmarks, const cv::Point2f& _origin, float* _aligned)
+  {
+    size_t row = 2 * size_t(_numLandmarks);
+    for (uint32_t ii = 0; ii < _num; ++ii)
+    {
+      const cv::Rect& box = _boxes[ii * _boxStride];
+      const float* src = _shapes + ii * _shapeStride * row;
+      float* dst = _aligned + ii * row;
+      detail::scaleOffset(src, dst, _numLandmarks, float(box.width), _origin.x * box.width + box.x);
+      detail::scaleOffset(src + _numLandmarks, dst + _numLandmarks, _numLandmarks, float(box.height), _origin.y * box.height + box.y);
+    }
+  }
+
+  /// Similarity transform x' = a x - b y + tx, y' = b x + a y + ty.
+  struct Similarity
+  {
+    float a;
+    float b;
+    float tx;
+    float ty;
+  };
+
+  /*!
+   Least squares similarity transform moving shape \c _shape onto \c _target.
+   */
+  inline Similarity fitSimilarity(const float* _shape, const float* _target, uint32_t _numLandmarks)
+  {
+    const float* xs = _shape;
+    const float* ys = _shape + _numLandmarks;
+    const float* txs = _target;
+    const float* tys = _target + _numLandmarks;
+
+    double cx = 0., cy = 0., tcx = 0., tcy = 0.;
+    for (uint32_t ii = 0; ii < _numLandmarks; ++ii)
+    {
+      cx += xs[ii]; cy += ys[ii]; tcx += txs[ii]; tcy += tys[ii];
+    }
+    cx /= _numLandmarks; cy /= _numLandmarks; tcx /= _numLandmarks; tcy /= _numLandmarks;
+
+    double dot = 0., cross = 0., norm = 0.;
+    for (uint32_t ii = 0; ii < _numLandmarks; ++ii)
+    {
+      double x = xs[ii] - cx, y = ys[ii] - cy;
+      double tx = txs[ii] - tcx, ty = tys[ii] - tcy;
+      dot += x * tx + y * ty;
+      cross += x * ty - y * tx;
+      norm += x * x + y * y;
+    }
+
+    Similarity sim = { 1.f, 0.f, 0.f, 0.f };
+    if (norm > 0.)
+    {
+      sim.a = float(dot / norm);
+      sim.b = float(cross / norm);
+    }
+    sim.tx = float(tcx - (sim.a * cx - sim.b * cy));
+    sim.ty = float(tcy - (sim.b * cx + sim.a * cy));
+    return sim;
+  }
+
+  /// Apply \c _sim to shape \c _shape into \c _out, which may be \c _shape.
+  inline void transformShape(const float* _shape, const Similarity& _sim, uint32_t _numLandmarks, float* _out)
+  {
+    for (uint32_t ii = 0; ii < _numLandmarks; ++ii)
+    {
+      float x = _shape[ii], y = _shape[ii + _numLandmarks];
+      _out[ii] = _sim.a * x - _sim.b * y + _sim.tx;
+      _out[ii + _numLandmarks] = _sim.b * x + _sim.a * y + _sim.ty;
+    }
+  }
+
+  namespace detail
+  {
+    const uint32_t kShapeChunk = 64;
+
+    /*!
+     Mean of \c _fn(shape, sums) over all shapes. Shapes are summed in fixed chunks in double and
+     chunks in order, so the result does not depend on the number of threads.
+
+     @param _partial  Scratch of one row of doubles per chunk, resized as needed.
+     */
+    template<typename Fn>
+    void reduceShapes(uint32_t _num, uint32_t _numLandmarks, uint32_t _numThreads, std::vector<double>& _partial, float* _mean, Fn _fn)
+    {
+      size_t row = 2 * size_t(_numLandmarks);
+      uint32_t num_chunks = (_num + kShapeChunk - 1) / kShapeChunk;
+      _partial.assign(num_chunks * row, 0.);
+      X::parallelFor(num_chunks, _numThreads, [&](uint32_t, uint32_t _chunk)
+      {
+        double* sums = _partial.data() + _chunk * row;
+        uint32_t end = std::min(_num, (_chunk + 1) * kShapeChunk);
+        for (uint32_t ii = _chunk * kShapeChunk; ii < end; ++ii)
+          _fn(ii, sums);
+      } );
+
+      for (size_t jj = 0; jj < row; ++jj)
+      {
+        double sum = 0.;
+        for (uint32_t cc = 0; cc < num_chunks; ++cc)
+          sum += _partial[cc * row + jj];
+        _mean[jj] = float(sum / std::max<uint32_t>(_num, 1));
+      }
+    }
+  }
+
+  /*!
+   Mean of \c _num contiguous shapes on \c _numThreads threads, deterministic.
+
+   @param _mean  Output row of \c 2 * _numLandmarks.
+   */
+  inline void meanShape(const float* _shapes, uint32_t _num, uint32_t _numLandmarks, float* _mean, uint32_t _numThreads = 0)
+  {
+    size_t row = 2 * size_t(_numLandmarks);
+    std::vector<double> partial;
+    detail::reduceShapes(_num, _numLandmarks, _numThreads, partial, _mean, [&](uint32_t _ii, double* X_RESTRICT _sums)
+    {
+      const float* X_RESTRICT shape = _shapes + _ii * row;
+      for (size_t jj = 0; jj < row; ++jj)
+        _sums[jj] += shape[jj];
+    } );
+  }
+
+  /*!
+   Generalised Procrustes mean: shapes are aligned by similarity transforms onto the mean, and the
+   mean recomputed from aligned shapes, until it moves less than \c _tolerance. Pose and scale
+   variation is removed from the mean, and the result is aligned back onto the plain mean so it
+   stays in the frame of the input shapes. Deterministic like \c meanShape.
+
+   @param _mean        Output row of \c 2 * _numLandmarks.
+   @param _iterations  Maximum number of iterations.
+   @param _tolerance   Stop once no coordinate of the mean moves more than that.
+   @return  Number of iterations run.
+   */
+  inline uint32_t procrustesMean(const float* _shapes, uint32_t _num, uint32_t _numLandmarks, float* _mean,
+                                 uint32_t _numThreads = 0, uint32_t _iterations = 10, float _tolerance = 1e-5f)
+  {
+    size_t row = 2 * size_t(_numLandmarks);
+    std::vector<float> reference(row), next(row);
+    std::vector<double> partial;
+    meanShape(_shapes, _num, _numLandmarks, reference.data(), _numThreads);
+    X::memCopy(_mean, reference.data(), row * sizeof(float));
+
+    uint32_t iteration = 0;
+    while (iteration < _iterations)
+    {
+      ++iteration;
+      detail::reduceShapes(_num, _numLandmarks, _numThreads, partial, next.data(), [&](uint32_t _ii, double* _sums)
+      {
+        const float* shape = _shapes + _ii * row;
+        Similarity sim = fitSimilarity(shape, _mean, _numLandmarks);
+        for (uint32_t jj = 0; jj < _numLandmarks; ++jj)
+        {
+          float x = shape[jj], y = shape[jj + _numLandmarks];
+          _sums[jj] += sim.a * x - sim.b * y + sim.tx;
+          _sums[jj + _numLandmarks] += sim.b * x + sim.a * y + sim.ty;
+        }
+      } );
+
+      // Fix the gauge, otherwise the mean may shrink, rotate or drift between iterations.
+      transformShape(next.data(), fitSimilarity(next.data(), reference.data(), _numLandmarks), _numLandmarks, next.data());
+      float change = 0.f;
+      for (size_t jj = 0; jj < row; ++jj)
+        change = std::max(change, std::fabs(next[jj] - _mean[jj]));
+      X::memCopy(_mean, next.data(), row * sizeof(float));
+      if (change < _tolerance)
+        break;
+    }
+    return iteration;
+  }
+
+}
+
+#endif  //SDM_SHAPE_H_HEADER_GUARD
@@ -0,0 +1,360 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef SDM_SHMDATA_H_HEADER_GUARD
+#define SDM_SHMDATA_H_HEADER_GUARD
+
+#include "iodata.hpp"
+
+#include <functional>
+#include <thread>
+
+/*
+ Shared dataset segment, decoded images of one IData in native endian:
+
+   ShmHeader
+   ShmSample[numSamples]                       sample index
+   float[numSamples][2 * numLandmarks]         landmarks, row layout x_1 ... x_n, y_1 ... y_n
+   char[]                                      image file names
+   pixel payloads                              continuous rows, each kShmAlign aligned, in decode order
+
+ Every block starts kShmAlign aligned. The publisher writes \c state last, readers wait for it.
+ */
+
+namespace SDM
+{
+
+  const char     kShmMagic[8] = { 'S', 'D', 'M', 'S', 'H', 'M', '\0', '\0' };
+  const uint32_t kShmVersion = 1;
+  const uint64_t kShmAlign = 64;
+
+  enum ShmState
+  {
+    kShmBuilding = 0,
+    kShmReady = 1,
+    kShmFailed = 2,
+  };
+
+  struct ShmHeader
+  {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  state;        //!< \c ShmState, accessed atomically.
+    uint32_t  numSamples;
+    uint32_t  numLandmarks;
+    uint64_t  indexOffset;
+    uint64_t  landmarkOffset;
+    uint64_t  nameOffset;
+    uint64_t  payloadOffset;
+    uint64_t  totalSize;
+  };
+  static_assert(sizeof(ShmHeader) == 64, "ShmHeader layout changed.");
+
+  struct ShmSample
+  {
+    uint64_t  dataOffset;
+    uint64_t  nameOffset;
+    int32_t   rows;
+    int32_t   cols;
+    int32_t   type;
+    uint32_t  nameSize;
+  };
+  static_assert(sizeof(ShmSample) == 32, "ShmSample layout changed.");
+
+  /*!
+   IO implement for read a dataset decoded once into POSIX shared memory. Images point directly into
+   the segment, so processes attached to the same segment share one copy of the pixels and images
+   must not be written.
+
+   Either a long running publisher, e.g. \c sdm-share, holds the segment and trainings attach to it,
+   or every training uses the loader constructor: the first one to come decodes and publishes, the
+   others wait for it and attach.
+   */
+  class SharedIO : public IData
+  {
+  public:
+
+    /// Creates the source dataset, called only by the process that publishes.
+    using Loader = std::function<std::unique_ptr<IData>()>;
+
+    /*!
+     Attach to published segment \c _name.
+
+     @param _name           Segment name, "/name".
+     @param _timeoutSeconds Time to wait for the segment to appear and get ready.
+     */
+    explicit SharedIO(const std::string& _name, double _timeoutSeconds = 600.)
+      : m_name(_name)
+      , m_publisher(false)
+    {
+      if (!attach(NULL, 0, _timeoutSeconds) )
+      {
+        throw std::runtime_error(std::string("Shared dataset not published: " + m_name));
+      }
+    }
+
+    /*!
+     Attach to segment \c _name, or publish it from \c _load() if it does not exist yet.
+
+     @param _name           Segment name, "/name".
+     @param _load           Creates the dataset to publish.
+     @param _numThreads     Threads decoding images when publishing, 0 means one per hardware thread.
+     @param _timeoutSeconds Time to wait for another publisher to get ready.
+     */
+    SharedIO(const std::string& _name, const Loader& _load, uint32_t _numThreads = 0, double _timeoutSeconds = 600.)
+      : m_name(_name)
+      , m_publisher(false)
+    {
+      if (!attach(&_load, _numThreads, _timeoutSeconds) )
+      {
+        throw std::runtime_error(std::string("Could neither publish nor open shared dataset: " + m_name));
+      }
+    }
+
+    /// Whether this process decoded and published the segment.
+    bool isPublisher() const { return m_publisher; }
+
+    /// Size of the segment in bytes.
+    size_t getSegmentSize() const { return m_shm.size(); }
+
+    /*!
+     Remove the segment name so that no new process attaches, attached ones keep their data. Memory
+     is freed once every process detached.
+     */
+    void unlink() const
+    {
+      X::SharedMemory::unlink(m_name.c_str());
+    }
+
+    virtual const std::vector<cv::Mat>& getData()
+    {
+      return m_images;
+    }
+
+    virtual cv::Mat getImage(uint32_t _index)
+    {
+      return m_images[_index];
+    }
+
+    virtual const LandmarkSet& getLandmarks()
+    {
+      return m_landmarks;
+    }
+
+    virtual const std::vector<fs::path>& getFilenames()
+    {
+      return m_filenames;
+    }
+
+  private:
+    /*!
+     Open the segment, publishing it from \c _load if given and the segment does not exist.
+
+     @return  False if there is no segment and nothing to publish it from.
+     */
+    bool attach(const Loader* _load, uint32_t _numThreads, double _timeoutSeconds)
+    {
+      auto begin = std::chrono::steady_clock::now();
+      auto expired = [&]()
+      {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() > _timeoutSeconds;
+      };
+
+      while (!m_shm.open(m_name.c_str()) )
+      {
+        if (NULL != _load && m_shm.create(m_name.c_str()) )
+        {
+          publish(*_load, _numThreads);
+          return true;
+        }
+        // Not published yet, or lost the race against another publisher which may have failed
+        // and unlinked in between.
+        if (expired())
+          return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+
+      // Publisher writes the header first, grows the segment while decoding and sets state last.
+      while (m_shm.currentSize() < sizeof(ShmHeader) || !m_shm.map()
+             || kShmBuilding == __atomic_load_n(&((const ShmHeader*)m_shm.data())->state, __ATOMIC_ACQUIRE) )
+      {
+        if (expired())
+        {
+          throw std::runtime_error(std::string("Timed out waiting for shared dataset, remove a stale one with sdm-share --unlink: " + m_name));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+
+      // Mapped while building, the segment has its final size only now.
+      if (!m_shm.map())
+      {
+        throw std::runtime_error(std::string("Could not map shared dataset: " + m_name));
+      }
+      const ShmHeader* header = (const ShmHeader*)m_shm.data();
+      if (kShmReady != header->state)
+      {
+        throw std::runtime_error(std::string("Publisher of shared dataset failed: " + m_name));
+      }
+      if (0 != X::memCmp(header->magic, kShmMagic, sizeof(kShmMagic)) || kShmVersion != header->version
+          || header->totalSize != m_shm.size())
+      {
+        throw std::runtime_error(std::string("Not a shared dataset or unsupported version: " + m_name));
+      }
+      bind();
+      return true;
+    }
+
+    /*!
+     Decode \c _load() into the created segment. The header goes in first, so that a failure can
+     always be signalled to waiting processes. Image sizes are known only once decoded, so the payload
+     grows as images come in and every image is freed once copied: peak memory is the segment and
+     the images in flight, not twice the dataset.
+     */
+    void publish(const Loader& _load, uint32_t _numThreads)
+    {
+      m_publisher = true;
+      try
+      {
+        ShmHeader header = {};
+        X::memCopy(header.magic, kShmMagic, sizeof(kShmMagic) );
+        header.version = kShmVersion;
+        header.state = kShmBuilding;
+        if (!m_shm.resize(sizeof(ShmHeader)) )
+        {
+          throw std::runtime_error(std::string("Could not allocate shared dataset: " + m_name));
+        }
+        X::memCopy(m_shm.data(), &header, sizeof(header));
+
+        std::unique_ptr<IData> data = _load();
+        const LandmarkSet& landmarks = data->getLandmarks();
+        const std::vector<fs::path>& filenames = data->getFilenames();
+        header.numSamples = uint32_t(filenames.size());
+        header.numLandmarks = landmarks.numLandmarks();
+
+        std::vector<ShmSample> samples(header.numSamples);
+        header.indexOffset = X::alignUp(sizeof(ShmHeader), kShmAlign);
+        header.landmarkOffset = X::alignUp(header.indexOffset + samples.size() * sizeof(ShmSample), kShmAlign);
+        header.nameOffset = X::alignUp(header.landmarkOffset + uint64_t(header.numSamples) * header.numLandmarks * 2 * sizeof(float), kShmAlign);
+
+        uint64_t offset = header.nameOffset;
+        for (uint32_t ii = 0; ii < samples.size(); ++ii)
+        {
+          samples[ii].nameOffset = offset;
+          samples[ii].nameSize = uint32_t(filenames[ii].string().size());
+          offset += samples[ii].nameSize;
+        }
+        header.payloadOffset = X::alignUp(offset, kShmAlign);
+
+        // Image files are decoded in background, which must be started before several threads
+        // wait for images.
+        ImageFileIO* image_files = dynamic_cast<ImageFileIO*>(data.get());
+        if (NULL != image_files)
+          image_files->prefetch(_numThreads);
+
+        std::mutex mutex;
+        uint64_t end = header.payloadOffset;
+        uint64_t capacity = header.payloadOffset;
+        X::parallelFor(header.numSamples, _numThreads, [&](uint32_t, uint32_t _ii)
+        {
+          cv::Mat image = data->getImage(_ii);
+          uint64_t size = image.total() * image.elemSize();
+          {
+            // Growing remaps the segment, so copies hold the lock too. They are cheap next to decoding.
+            std::lock_guard<std::mutex> lock(mutex);
+            uint64_t dst_offset = X::alignUp(end, kShmAlign);
+            if (dst_offset + size > capacity)
+            {
+              capacity = std::max(2 * capacity, dst_offset + size);
+              if (!m_shm.resize(size_t(capacity)) )
+              {
+                throw std::runtime_error(std::string("Could not allocate shared dataset: " + m_name));
+              }
+            }
+            ShmSample& sample = samples[_ii];
+            sample.rows = image.rows;
+            sample.cols = image.cols;
+            sample.type = image.type();
+            sample.dataOffset = dst_offset;
+            cv::Mat dst(image.rows, image.cols, image.type(), m_shm.data() + dst_offset);
+            image.copyTo(dst);
+            end = dst_offset + size;
+          }
+          image.release();
+          if (NULL != image_files)
+            image_files->releaseImage(_ii);
+        });
+
+        header.totalSize = X::alignUp(end, kShmAlign);
+        if (!m_shm.resize(size_t(header.totalSize)) )
+        {
+          throw std::runtime_error(std::string("Could not allocate shared dataset: " + m_name));
+        }
+
+        uint8_t* base = m_shm.data();
+        X::memCopy(base + header.indexOffset, samples.data(), samples.size() * sizeof(ShmSample));
+        X::memCopy(base + header.landmarkOffset, landmarks.data(), uint64_t(header.numSamples) * header.numLandmarks * 2 * sizeof(float));
+        for (uint32_t ii = 0; ii < samples.size(); ++ii)
+        {
+          std::string name = filenames[ii].string();
+          X::memCopy(base + samples[ii].nameOffset, name.data(), name.size());
+        }
+        X::memCopy(base, &header, sizeof(header));
+
+        __atomic_store_n(&((ShmHeader*)base)->state, uint32_t(kShmReady), __ATOMIC_RELEASE);
+      }
+      catch (...)
+      {
+        // Wake up waiting processes with an error and let the next run publish again.
+        if (m_shm.size() >= sizeof(ShmHeader))
+          __atomic_store_n(&((ShmHeader*)m_shm.data())->state, uint32_t(kShmFailed), __ATOMIC_RELEASE);
+        unlink();
+        throw;
+      }
+      bind();
+    }
+
+    /// Point images into the mapped segment, copy landmarks and names.
+    void bind()
+    {
+      uint8_t* base = m_shm.data();
+      const ShmHeader* header = (const ShmHeader*)base;
+      const ShmSample* samples = (const ShmSample*)(base + header->indexOffset);
+      m_images.resize(header->numSamples);
+      m_landmarks = LandmarkSet(numberedLandmarkNames(header->numLandmarks), header->numSamples);
+      X::memCopy(m_landmarks.data(), base + header->landmarkOffset, size_t(header->numSamples) * header->numLandmarks * 2 * sizeof(float));
+      m_filenames.clear();
+      m_filenames.reserve(header->numSamples);
+      for (uint32_t ii = 0; ii < header->numSamples; ++ii)
+      {
+        const ShmSample& sample = samples[ii];
+        m_images[ii] = cv::Mat(sample.rows, sample.cols, sample.type, base + sample.dataOffset);
+        m_filenames.emplace_back(std::string((const char*)base + sample.nameOffset, sample.nameSize));
+      }
+    }
+
+    std::string             m_name;
+    bool                    m_publisher;
+    X::SharedMemory         m_shm;
+    std::vector<cv::Mat>    m_images;
+    std::vector<fs::path>   m_filenames;
+    LandmarkSet             m_landmarks;
+  };
+
+}
+
+#endif  //SDM_SHMDATA_H_HEADER_GUARD
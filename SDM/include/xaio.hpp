@@ -0,0 +1,527 @@
+/*
+ XAio :: X asynchronous file reading
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef X_AIO_H_HEADER_GUARD
+#define X_AIO_H_HEADER_GUARD
+
+#include <stdint.h> // uint32_t
+#include <stdlib.h> // size_t
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "xio.hpp"
+#include "xthread.hpp"
+
+/// io_uring is used when kernel headers have it, define X_WITH_IO_URING 0 to force the thread pool.
+#ifndef X_WITH_IO_URING
+#  if defined(__linux__) && defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#      define X_WITH_IO_URING 1
+#    endif
+#  endif
+#endif
+#ifndef X_WITH_IO_URING
+#  define X_WITH_IO_URING 0
+#endif
+
+#if X_WITH_IO_URING
+#  include <linux/io_uring.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>  // iovec
+#  include <cerrno>
+#  if !defined(__NR_io_uring_setup) || !defined(__NR_io_uring_enter)
+#    undef  X_WITH_IO_URING
+#    define X_WITH_IO_URING 0
+#  endif
+#endif
+
+namespace X
+{
+#if X_WITH_IO_URING
+  namespace detail
+  {
+    /*!
+     Minimal io_uring submission and completion rings on raw syscalls, enough for reading whole
+     files. The submitting thread owns the submission tail and the completion head.
+     */
+    class IoUring
+    {
+    public:
+      IoUring()
+        : m_fd(-1)
+        , m_sqRing(MAP_FAILED)
+        , m_cqRing(MAP_FAILED)
+        , m_sqes(MAP_FAILED)
+        , m_unsubmitted(0)
+      {
+      }
+
+      ~IoUring() { close(); }
+
+      IoUring(const IoUring&) = delete;
+      IoUring& operator=(const IoUring&) = delete;
+
+      /// Set up rings of \c _entries, false if the kernel does not support or allow io_uring.
+      bool init(uint32_t _entries)
+      {
+        io_uring_params params = {};
+        m_fd = int(::syscall(__NR_io_uring_setup, _entries, &params));
+        if (m_fd < 0)
+          return false;
+
+        m_sqSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+        if (single_mmap)
+          m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+
+        m_sqRing = ::mmap(NULL, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        m_cqRing = single_mmap ? m_sqRing : ::mmap(NULL, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        m_sqes = ::mmap(NULL, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        m_sqEntries = params.sq_entries;
+        if (MAP_FAILED == m_sqRing || MAP_FAILED == m_cqRing || MAP_FAILED == m_sqes)
+        {
+          close();
+          return false;
+        }
+
+        uint8_t* sq = (uint8_t*)m_sqRing;
+        uint8_t* cq = (uint8_t*)m_cqRing;
+        m_sqTail = (uint32_t*)(sq + params.sq_off.tail);
+        m_sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+        m_sqArray = (uint32_t*)(sq + params.sq_off.array);
+        m_cqHead = (uint32_t*)(cq + params.cq_off.head);
+        m_cqTail = (uint32_t*)(cq + params.cq_off.tail);
+        m_cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+      }
+
+      ///
+      void close()
+      {
+        if (MAP_FAILED != m_sqes)
+          ::munmap(m_sqes, m_sqEntries * sizeof(io_uring_sqe));
+        if (MAP_FAILED != m_cqRing && m_cqRing != m_sqRing)
+          ::munmap(m_cqRing, m_cqSize);
+        if (MAP_FAILED != m_sqRing)
+          ::munmap(m_sqRing, m_sqSize);
+        if (0 <= m_fd)
+          ::close(m_fd);
+        m_fd = -1;
+        m_sqRing = m_cqRing = m_sqes = MAP_FAILED;
+      }
+
+      /// Queue a vectored read of \c _iov at \c _offset, submitted by next \c enter.
+      void queueRead(int _fd, iovec* _iov, uint64_t _offset, uint64_t _userData)
+      {
+        uint32_t tail = *m_sqTail;
+        uint32_t slot = tail & m_sqMask;
+        io_uring_sqe& sqe = ((io_uring_sqe*)m_sqes)[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = _fd;
+        sqe.addr = (uint64_t)(uintptr_t)_iov;
+        sqe.len = 1;
+        sqe.off = _offset;
+        sqe.user_data = _userData;
+        m_sqArray[slot] = slot;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++m_unsubmitted;
+      }
+
+      /*!
+       Submit queued reads and wait for at least \c _minComplete completions.
+
+       @return  False on a ring error other than an interrupted wait.
+       */
+      bool enter(uint32_t _minComplete)
+      {
+        long ret = ::syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, _minComplete, _minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret < 0)
+          return EINTR == errno || EAGAIN == errno || EBUSY == errno;
+        m_unsubmitted -= uint32_t(ret);
+        return true;
+      }
+
+      /// Call \c _fn(userData, result) for every available completion.
+      template<typename Fn>
+      void reap(Fn _fn)
+      {
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+          const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+          uint64_t user_data = cqe.user_data;
+          int32_t res = cqe.res;
+          __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+          _fn(user_data, res);
+        }
+      }
+
+    private:
+      int            m_fd;
+      void*          m_sqRing;
+      void*          m_cqRing;
+      void*          m_sqes;
+      size_t         m_sqSize;
+      size_t         m_cqSize;
+      uint32_t       m_sqEntries;
+      uint32_t*      m_sqTail;
+      uint32_t       m_sqMask;
+      uint32_t*      m_sqArray;
+      uint32_t*      m_cqHead;
+      uint32_t*      m_cqTail;
+      uint32_t       m_cqMask;
+      io_uring_cqe*  m_cqes;
+      uint32_t       m_unsubmitted;
+    };
+  }
+#endif
+
+  /// A whole file read by \c FileReader.
+  struct FileData
+  {
+    FileData()
+      : index(0)
+      , size(-1)
+    {
+    }
+
+    uint32_t           index;  //!< Index of the file in the list given to \c FileReader.
+    int64_t            size;   //!< Bytes read, -1 if the file could not be read.
+    std::vector<char>  data;   //!< File bytes and a trailing '\0', like \c readFile.
+  };
+
+  /*!
+   Read a list of files in background with up to \c queueDepth reads in flight, and hand whole
+   files to consumers in completion order. On Linux reads go through io_uring from one thread,
+   elsewhere or when io_uring is not allowed through a pool of \c queueDepth blocking readers.
+   At most \c queueDepth files are read or waiting for a consumer at any time, which bounds memory.
+   */
+  class FileReader
+  {
+  public:
+    /*!
+     Start reading.
+
+     @param _files       Files to read.
+     @param _queueDepth  Reads in flight.
+     */
+    FileReader(const std::vector<std::string>& _files, uint32_t _queueDepth = 32)
+      : m_files(_files)
+      , m_queueDepth(std::max<uint32_t>(_queueDepth, 1))
+      , m_next(0)
+      , m_numBusy(0)
+      , m_numTaken(0)
+      , m_stop(false)
+      , m_ioUring(false)
+    {
+      if (m_files.empty())
+        return;
+
+#if X_WITH_IO_URING
+      std::unique_ptr<detail::IoUring> ring(new detail::IoUring());
+      if (ring->init(m_queueDepth))
+      {
+        m_ioUring = true;
+        m_threads.emplace_back(&FileReader::runIoUring, this, ring.release());
+        return;
+      }
+#endif
+      uint32_t num_threads = std::min<size_t>(m_queueDepth, m_files.size());
+      for (uint32_t tt = 0; tt < num_threads; ++tt)
+        m_threads.emplace_back(&FileReader::runBlocking, this);
+    }
+
+    ~FileReader()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_space.notify_all();
+      for (auto& thread : m_threads)
+        thread.join();
+    }
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    /*!
+     Block until next file is read. Buffer previously held by \c _file is recycled.
+
+     @return  False when every file has been handed out.
+     */
+    bool next(FileData& _file)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (0 != _file.data.capacity() && m_spare.size() < m_queueDepth)
+        m_spare.emplace_back(std::move(_file.data));
+      m_ready.wait(lock, [this]{ return !m_done.empty() || m_numTaken == m_files.size(); });
+      if (m_done.empty())
+        return false;
+
+      _file = std::move(m_done.front());
+      m_done.pop_front();
+      if (++m_numTaken == m_files.size())
+        m_ready.notify_all();
+      lock.unlock();
+      m_space.notify_one();
+      return true;
+    }
+
+    /// Whether reads go through io_uring.
+    bool isIoUring() const { return m_ioUring; }
+
+  private:
+    /// Take a recycled buffer, called under lock.
+    std::vector<char> spare()
+    {
+      std::vector<char> buffer;
+      if (!m_spare.empty())
+      {
+        buffer = std::move(m_spare.back());
+        m_spare.pop_back();
+      }
+      return buffer;
+    }
+
+    void push(FileData&& _file)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done.emplace_back(std::move(_file));
+      m_ready.notify_one();
+    }
+
+    void runBlocking()
+    {
+      for (;;)
+      {
+        FileData file;
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_space.wait(lock, [this]{ return m_stop || m_done.size() + m_numBusy < m_queueDepth; });
+          if (m_stop || m_next == m_files.size())
+            return;
+          file.index = m_next++;
+          file.data = spare();
+          ++m_numBusy;
+        }
+
+        file.size = readFile(m_files[file.index].c_str(), file.data);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_numBusy;
+        m_done.emplace_back(std::move(file));
+        m_ready.notify_one();
+      }
+    }
+
+#if X_WITH_IO_URING
+    struct Slot
+    {
+      FileData  file;
+      int       fd;
+      uint64_t  offset;
+      iovec     iov;
+    };
+
+    void runIoUring(detail::IoUring* _ring)
+    {
+      std::unique_ptr<detail::IoUring> ring(_ring);
+      std::vector<Slot> slots(m_queueDepth);
+      std::vector<uint32_t> free_slots;
+      for (uint32_t ss = 0; ss < m_queueDepth; ++ss)
+        free_slots.push_back(m_queueDepth - 1 - ss);
+      bool failed = false;
+
+      auto queue = [&](uint32_t _slot)
+      {
+        Slot& slot = slots[_slot];
+        slot.iov.iov_base = slot.file.data.data() + slot.offset;
+        slot.iov.iov_len = size_t(slot.file.size) - slot.offset;
+        ring->queueRead(slot.fd, &slot.iov, slot.offset, _slot);
+      };
+
+      auto finish = [&](uint32_t _slot, bool _ok)
+      {
+        Slot& slot = slots[_slot];
+        ::close(slot.fd);
+        if (!_ok)
+          slot.file.size = -1;
+        else
+          slot.file.data[size_t(slot.file.size)] = '\0';
+        push(std::move(slot.file));
+        free_slots.push_back(_slot);
+      };
+
+      for (;;)
+      {
+        // Open files and queue reads while there is room, tiny and unreadable files complete at once.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        uint32_t in_flight = m_queueDepth - uint32_t(free_slots.size());
+        if (0 == in_flight)
+        {
+          m_space.wait(lock, [this]{ return m_stop || m_done.size() < m_queueDepth; });
+          if (m_stop || m_next == m_files.size() || failed)
+            break;
+        }
+        while (!m_stop && !failed && m_next < m_files.size() && !free_slots.empty() && m_done.size() + in_flight < m_queueDepth)
+        {
+          FileData file;
+          file.index = m_next++;
+          file.data = spare();
+          lock.unlock();
+
+          int fd = ::open(m_files[file.index].c_str(), O_RDONLY);
+          struct stat st;
+          bool opened = 0 <= fd && 0 == ::fstat(fd, &st);
+          if (!opened || 0 == st.st_size)
+          {
+            if (0 <= fd)
+              ::close(fd);
+            file.size = opened ? 0 : -1;
+            file.data.assign(1, '\0');
+            push(std::move(file));
+          }
+          else
+          {
+            uint32_t ss = free_slots.back();
+            free_slots.pop_back();
+            file.size = int64_t(st.st_size);
+            file.data.resize(size_t(st.st_size) + 1);
+            slots[ss].file = std::move(file);
+            slots[ss].fd = fd;
+            slots[ss].offset = 0;
+            queue(ss);
+            ++in_flight;
+          }
+          lock.lock();
+        }
+        lock.unlock();
+
+        if (0 == in_flight)
+        {
+          std::lock_guard<std::mutex> guard(m_mutex);
+          if (m_stop || m_next == m_files.size() || failed)
+            break;
+          continue;
+        }
+
+        if (!failed && ring->enter(1))
+        {
+          // Short reads are continued, errors fail the file.
+          ring->reap([&](uint64_t _slot, int32_t _res)
+          {
+            Slot& slot = slots[_slot];
+            if (0 < _res)
+              slot.offset += uint64_t(_res);
+            if (0 < _res && slot.offset < uint64_t(slot.file.size))
+              queue(uint32_t(_slot));
+            else
+              finish(uint32_t(_slot), 0 < _res);
+          });
+        }
+        else
+        {
+          // Ring broke, in flight reads may still write their buffers, so leave them alone.
+          failed = true;
+          for (uint32_t ss = 0; ss < m_queueDepth; ++ss)
+          {
+            if (std::find(free_slots.begin(), free_slots.end(), ss) == free_slots.end())
+            {
+              ::close(slots[ss].fd);
+              FileData file;
+              file.index = slots[ss].file.index;
+              push(std::move(file));
+            }
+          }
+          break;
+        }
+      }
+
+      // Files never started after a ring error are read with blocking io.
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (failed && !m_stop && m_next < m_files.size())
+      {
+        FileData file;
+        file.index = m_next++;
+        lock.unlock();
+        file.size = readFile(m_files[file.index].c_str(), file.data);
+        push(std::move(file));
+        lock.lock();
+      }
+      lock.unlock();
+
+      // Release the ring before buffers of reads that may be in flight.
+      ring.reset();
+    }
+#endif
+
+    std::vector<std::string>        m_files;
+    uint32_t                        m_queueDepth;
+    uint32_t                        m_next;      //!< Next file to start, guarded by m_mutex.
+    uint32_t                        m_numBusy;   //!< Blocking reads in progress.
+    size_t                          m_numTaken;
+    bool                            m_stop;
+    bool                            m_ioUring;
+    std::deque<FileData>            m_done;
+    std::vector<std::vector<char>>  m_spare;
+    std::mutex                      m_mutex;
+    std::condition_variable         m_ready;
+    std::condition_variable         m_space;
+    std::vector<std::thread>        m_threads;
+  };
+
+  /*!
+   Read \c _files with a \c FileReader and call \c _fn(threadId, file) for each of them on up to
+   \c _numThreads consumer threads, the calling thread is one of them. Files come in completion
+   order, use \c file.index to place results.
+
+   @param _files       Files to read.
+   @param _numThreads  Consumer threads, 0 means one per hardware thread.
+   @param _fn          Functor \c void(uint32_t _threadId, const FileData& _file).
+   @param _queueDepth  Reads in flight.
+   */
+  template<typename Fn>
+  void parallelRead(const std::vector<std::string>& _files, uint32_t _numThreads, Fn _fn, uint32_t _queueDepth = 32)
+  {
+    FileReader reader(_files, _queueDepth);
+    uint32_t num_threads = std::min<size_t>(numThreads(_numThreads), _files.size());
+    parallelFor(num_threads, num_threads, [&](uint32_t _threadId, uint32_t)
+    {
+      FileData file;
+      while (reader.next(file))
+        _fn(_threadId, file);
+    });
+  }
+
+}
+
+
+#endif //X_AIO_H_HEADER_GUARD
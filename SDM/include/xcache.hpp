@@ -0,0 +1,129 @@
+/*
+ XCache :: X cache containers
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef X_CACHE_H_HEADER_GUARD
+#define X_CACHE_H_HEADER_GUARD
+
+#include <stdint.h> // uint64_t
+#include <stdlib.h> // size_t
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace X
+{
+  /*!
+   Least recently used cache bounded by total cost of its values, e.g. bytes. Not thread safe.
+   */
+  template<typename Key, typename Value>
+  class LruCache
+  {
+  public:
+    explicit LruCache(size_t _capacity)
+      : m_capacity(_capacity)
+      , m_cost(0)
+      , m_numEvictions(0)
+    {
+    }
+
+    /*!
+     Find value of \c _key and mark it as most recently used.
+
+     @return  Pointer to value, valid until next insert, or NULL if not cached.
+     */
+    Value* find(const Key& _key)
+    {
+      auto found = m_index.find(_key);
+      if (m_index.end() == found)
+        return NULL;
+      m_entries.splice(m_entries.begin(), m_entries, found->second);
+      return &found->second->value;
+    }
+
+    /*!
+     Insert or replace value of \c _key, then evict least recently used values until total
+     cost fits capacity. A value costing more than capacity is not cached at all.
+
+     @return  Number of evicted values.
+     */
+    uint32_t insert(const Key& _key, Value _value, size_t _cost)
+    {
+      erase(_key);
+      if (_cost > m_capacity)
+        return 0;
+
+      uint32_t num_evicted = 0;
+      while (m_cost + _cost > m_capacity)
+      {
+        m_cost -= m_entries.back().cost;
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+        ++num_evicted;
+      }
+      m_numEvictions += num_evicted;
+
+      m_entries.push_front(Entry{ _key, std::move(_value), _cost });
+      m_index[_key] = m_entries.begin();
+      m_cost += _cost;
+      return num_evicted;
+    }
+
+    ///
+    bool erase(const Key& _key)
+    {
+      auto found = m_index.find(_key);
+      if (m_index.end() == found)
+        return false;
+      m_cost -= found->second->cost;
+      m_entries.erase(found->second);
+      m_index.erase(found);
+      return true;
+    }
+
+    ///
+    void clear()
+    {
+      m_entries.clear();
+      m_index.clear();
+      m_cost = 0;
+    }
+
+    size_t size() const { return m_entries.size(); }
+    size_t cost() const { return m_cost; }
+    size_t capacity() const { return m_capacity; }
+    uint64_t numEvictions() const { return m_numEvictions; }
+
+  private:
+    struct Entry
+    {
+      Key     key;
+      Value   value;
+      size_t  cost;
+    };
+
+    size_t    m_capacity;
+    size_t    m_cost;
+    uint64_t  m_numEvictions;
+    std::list<Entry> m_entries; // most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> m_index;
+  };
+
+}
+
+
+#endif //X_CACHE_H_HEADER_GUARD
@@ -53,6 +53,14 @@ namespace X
     return scaled;
   }
   
+  /// Grow \c _box by \c _ratio of its size on every side.
+  inline cv::Rect pad(const cv::Rect& _box, float _ratio)
+  {
+    int32_t dx = int32_t(_box.width * _ratio);
+    int32_t dy = int32_t(_box.height * _ratio);
+    return cv::Rect(_box.x - dx, _box.y - dy, _box.width + 2 * dx, _box.height + 2 * dy);
+  }
+  
   ///
   cv::Rect perturb(const cv::Rect& _box, float _transRatioX, float _transRatioY, float _scale = 1.f)
   {
@@ -71,6 +79,31 @@ namespace X
     return perturteb_box;
   }
   
+  /*!
+   Set the number of OpenCV internal threads while in scope, restoring the previous number on exit.
+   Used when own workers already run OpenCV calls in parallel, so both do not oversubscribe cores.
+   */
+  class ScopedCvThreads
+  {
+  public:
+    explicit ScopedCvThreads(int _num)
+      : m_previous(cv::getNumThreads())
+    {
+      cv::setNumThreads(_num);
+    }
+    
+    ~ScopedCvThreads()
+    {
+      cv::setNumThreads(m_previous);
+    }
+    
+    ScopedCvThreads(const ScopedCvThreads&) = delete;
+    ScopedCvThreads& operator=(const ScopedCvThreads&) = delete;
+    
+  private:
+    int m_previous;
+  };
+  
 }
 
 
@@ -0,0 +1,265 @@
+/*
+ XIO :: X file io
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef X_IO_H_HEADER_GUARD
+#define X_IO_H_HEADER_GUARD
+
+#include <stdint.h> // uint32_t
+#include <stdlib.h> // size_t
+#include <cstdio>
+#include <vector>
+
+#include <fcntl.h>    // open
+#include <unistd.h>   // close
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+
+namespace X
+{
+  /*!
+   Read whole file into \c _buffer. The buffer is resized to the file size plus a
+   trailing '\0', so text parsers can use strtof family on it directly. The capacity
+   of \c _buffer is kept, reusing it across calls avoids heap allocation.
+
+   @return  Number of bytes read, or -1 if the file could not be opened or read.
+   */
+  inline int64_t readFile(const char* _filePath, std::vector<char>& _buffer)
+  {
+    std::FILE* file = std::fopen(_filePath, "rb");
+    if (NULL == file)
+    {
+      return -1;
+    }
+
+    int64_t size = -1;
+    if (0 == std::fseek(file, 0, SEEK_END) )
+    {
+      size = std::ftell(file);
+      std::fseek(file, 0, SEEK_SET);
+    }
+
+    if (0 <= size)
+    {
+      _buffer.resize(size_t(size) + 1);
+      if (size_t(size) != std::fread(_buffer.data(), 1, size_t(size), file) )
+      {
+        size = -1;
+      }
+      _buffer[size_t(size < 0 ? 0 : size)] = '\0';
+    }
+    std::fclose(file);
+    return size;
+  }
+
+  /*!
+   Read only, shared memory mapping of a whole file. Pages live in the page cache, so processes
+   mapping the same file share them.
+   */
+  class MappedFile
+  {
+  public:
+    MappedFile()
+      : m_data(NULL)
+      , m_size(0)
+    {
+    }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /*!
+     Map \c _filePath, closes previous mapping first.
+
+     @return  False if the file could not be opened or mapped.
+     */
+    bool open(const char* _filePath)
+    {
+      close();
+      int fd = ::open(_filePath, O_RDONLY);
+      if (fd < 0)
+      {
+        return false;
+      }
+
+      struct stat st;
+      if (0 == ::fstat(fd, &st) && 0 < st.st_size)
+      {
+        void* data = ::mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (MAP_FAILED != data)
+        {
+          m_data = (const uint8_t*)data;
+          m_size = size_t(st.st_size);
+        }
+      }
+      ::close(fd);
+      return NULL != m_data;
+    }
+
+    ///
+    void close()
+    {
+      if (NULL != m_data)
+      {
+        ::munmap((void*)m_data, m_size);
+        m_data = NULL;
+        m_size = 0;
+      }
+    }
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    const uint8_t* m_data;
+    size_t         m_size;
+  };
+
+  /*!
+   POSIX shared memory segment. The creator sizes and maps it read-write, other processes open
+   and map it read only, and all mappings share the same physical pages.
+   */
+  class SharedMemory
+  {
+  public:
+    SharedMemory()
+      : m_fd(-1)
+      , m_data(NULL)
+      , m_size(0)
+    {
+    }
+
+    ~SharedMemory() { close(); }
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    /*!
+     Create segment \c _name, which must not exist yet, closes previous segment first.
+
+     @param _name  Segment name, "/name" on POSIX.
+     @return  False if the segment exists or could not be created.
+     */
+    bool create(const char* _name)
+    {
+      close();
+      m_fd = ::shm_open(_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+      return 0 <= m_fd;
+    }
+
+    /*!
+     Open existing segment \c _name read only, closes previous segment first.
+
+     @return  False if the segment does not exist or could not be opened.
+     */
+    bool open(const char* _name)
+    {
+      close();
+      m_fd = ::shm_open(_name, O_RDONLY, 0);
+      return 0 <= m_fd;
+    }
+
+    /// Current size of the opened segment, 0 until its creator resizes it.
+    size_t currentSize() const
+    {
+      struct stat st;
+      return 0 <= m_fd && 0 == ::fstat(m_fd, &st) ? size_t(st.st_size) : 0;
+    }
+
+    /*!
+     Resize a created segment to \c _size bytes and map it read-write.
+
+     @return  False if resizing or mapping failed.
+     */
+    bool resize(size_t _size)
+    {
+      unmap();
+      if (0 > m_fd || 0 != ::ftruncate(m_fd, off_t(_size)) )
+        return false;
+      return mapAs(_size, PROT_READ | PROT_WRITE);
+    }
+
+    /*!
+     Map an opened segment read only at its current size.
+
+     @return  False if it is still empty or could not be mapped.
+     */
+    bool map()
+    {
+      unmap();
+      size_t size = currentSize();
+      return 0 != size && mapAs(size, PROT_READ);
+    }
+
+    ///
+    void close()
+    {
+      unmap();
+      if (0 <= m_fd)
+      {
+        ::close(m_fd);
+        m_fd = -1;
+      }
+    }
+
+    /// Remove segment \c _name, existing mappings stay valid.
+    static bool unlink(const char* _name)
+    {
+      return 0 == ::shm_unlink(_name);
+    }
+
+    uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    bool mapAs(size_t _size, int _prot)
+    {
+      void* data = ::mmap(NULL, _size, _prot, MAP_SHARED, m_fd, 0);
+      if (MAP_FAILED == data)
+        return false;
+      m_data = (uint8_t*)data;
+      m_size = _size;
+      return true;
+    }
+
+    void unmap()
+    {
+      if (NULL != m_data)
+      {
+        ::munmap(m_data, m_size);
+        m_data = NULL;
+        m_size = 0;
+      }
+    }
+
+    int       m_fd;
+    uint8_t*  m_data;
+    size_t    m_size;
+  };
+
+  /// Round \c _value up to multiple of \c _align, which must be power of two.
+  inline uint64_t alignUp(uint64_t _value, uint64_t _align)
+  {
+    return (_value + _align - 1) & ~(_align - 1);
+  }
+
+}
+
+
+#endif //X_IO_H_HEADER_GUARD
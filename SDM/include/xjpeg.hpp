@@ -0,0 +1,171 @@
+/*
+ XJpeg :: X JPEG region decode
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef X_JPEG_H_HEADER_GUARD
+#define X_JPEG_H_HEADER_GUARD
+
+#include <opencv2/core/core.hpp>
+
+#include <stdint.h> // uint32_t
+#include <stdlib.h> // size_t
+
+/// Set by CMake when the linked libjpeg has \c jpeg_crop_scanline, i.e. libjpeg-turbo 1.5 or newer.
+/// Version macros cannot tell, \c LIBJPEG_TURBO_VERSION_NUMBER only exists since 2.0.
+#ifndef X_WITH_LIBJPEG
+#     define X_WITH_LIBJPEG 0
+#endif
+
+#if X_WITH_LIBJPEG
+#     include <cstdio>
+#     include <csetjmp>
+#     include <cstring>
+#     include <jpeglib.h>
+#endif
+
+namespace X
+{
+#if X_WITH_LIBJPEG
+  namespace detail
+  {
+    struct JpegError
+    {
+      jpeg_error_mgr  mgr;
+      jmp_buf         jump;
+    };
+
+    inline void jpegErrorExit(j_common_ptr _cinfo)
+    {
+      longjmp(((JpegError*)_cinfo->err)->jump, 1);
+    }
+
+    inline void jpegOutputMessage(j_common_ptr)
+    {
+    }
+
+    /// EXIF orientation of saved APP1 markers, 1 (upright) when there is none.
+    inline uint16_t jpegOrientation(j_decompress_ptr _cinfo)
+    {
+      for (jpeg_saved_marker_ptr marker = _cinfo->marker_list; NULL != marker; marker = marker->next)
+      {
+        const uint8_t* exif = marker->data;
+        uint32_t size = marker->data_length;
+        if (JPEG_APP0 + 1 != marker->marker || size < 14 || 0 != memcmp(exif, "Exif\0\0", 6))
+          continue;
+
+        const uint8_t* tiff = exif + 6;
+        size -= 6;
+        bool le = 'I' == tiff[0];
+        auto u16 = [tiff, le](uint32_t _at) { return uint16_t(le ? tiff[_at] | tiff[_at + 1] << 8 : tiff[_at] << 8 | tiff[_at + 1]); };
+        auto u32 = [tiff, le](uint32_t _at) { return le ? uint32_t(tiff[_at] | tiff[_at + 1] << 8 | tiff[_at + 2] << 16 | uint32_t(tiff[_at + 3]) << 24)
+                                                        : uint32_t(uint32_t(tiff[_at]) << 24 | tiff[_at + 1] << 16 | tiff[_at + 2] << 8 | tiff[_at + 3]); };
+        uint32_t ifd = u32(4);
+        if (uint64_t(ifd) + 2 > size)
+          return 1;
+        uint16_t num_entries = u16(ifd);
+        for (uint32_t ee = 0; ee < num_entries && uint64_t(ifd) + 2 + (ee + 1) * 12 <= size; ++ee)
+        {
+          uint32_t entry = ifd + 2 + ee * 12;
+          if (0x0112 == u16(entry))
+            return u16(entry + 8);
+        }
+      }
+      return 1;
+    }
+  }
+
+  /*!
+   Decode only the part of a JPEG covering \c _roi. Rows above the region are skipped, rows below
+   are never decoded and columns are cropped to whole iMCUs, so the cost is about proportional to
+   the region area. The decoded region may be wider than requested and is clipped to the image.
+
+   @param _data       JPEG file bytes.
+   @param _size       Size of \c _data.
+   @param _roi        Region in coordinates of the decoded, i.e. reduced, image. Set to the region
+                      actually decoded on success.
+   @param _grayscale  Decode one channel instead of BGR.
+   @param _reduction  DCT downscale factor 1, 2, 4 or 8.
+   @param _out        Decoded region, \c _roi.height x \c _roi.width.
+   @return  False if region decoding is not possible, e.g. not a JPEG, a rotated EXIF orientation
+            or libjpeg-turbo not available. Callers should then fall back to a full decode.
+   */
+  inline bool decodeJpegRegion(const uint8_t* _data, size_t _size, cv::Rect& _roi, bool _grayscale, uint32_t _reduction, cv::Mat& _out)
+  {
+    jpeg_decompress_struct cinfo;
+    detail::JpegError error;
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = detail::jpegErrorExit;
+    error.mgr.output_message = detail::jpegOutputMessage;
+    jpeg_create_decompress(&cinfo);
+
+    // Everything touched after setjmp lives outside this frame or is volatile.
+    if (setjmp(error.jump))
+    {
+      jpeg_destroy_decompress(&cinfo);
+      return false;
+    }
+
+    jpeg_mem_src(&cinfo, (unsigned char*)_data, (unsigned long)_size);
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+    if (JPEG_HEADER_OK != jpeg_read_header(&cinfo, TRUE) || 1 != detail::jpegOrientation(&cinfo))
+    {
+      jpeg_destroy_decompress(&cinfo);
+      return false;
+    }
+
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = _reduction;
+    cinfo.out_color_space = _grayscale ? JCS_GRAYSCALE : JCS_EXT_BGR;
+    jpeg_start_decompress(&cinfo);
+
+    cv::Rect roi = _roi & cv::Rect(0, 0, int(cinfo.output_width), int(cinfo.output_height));
+    if (roi.empty())
+    {
+      jpeg_destroy_decompress(&cinfo);
+      return false;
+    }
+
+    JDIMENSION xoffset = JDIMENSION(roi.x);
+    JDIMENSION width = JDIMENSION(roi.width);
+    jpeg_crop_scanline(&cinfo, &xoffset, &width);
+    if (0 < roi.y)
+      jpeg_skip_scanlines(&cinfo, JDIMENSION(roi.y));
+
+    _out.create(roi.height, int(width), _grayscale ? CV_8UC1 : CV_8UC3);
+    while (cinfo.output_scanline < JDIMENSION(roi.y + roi.height))
+    {
+      JSAMPROW row = _out.ptr<uint8_t>(int(cinfo.output_scanline) - roi.y);
+      jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    _roi = cv::Rect(int(xoffset), roi.y, int(width), roi.height);
+    return true;
+  }
+#else
+  inline bool decodeJpegRegion(const uint8_t*, size_t, cv::Rect&, bool, uint32_t, cv::Mat&)
+  {
+    return false;
+  }
+#endif
+
+}
+
+
+#endif //X_JPEG_H_HEADER_GUARD
@@ -21,6 +21,7 @@
 #define X_MATH_H_HEADER_GUARD
 
 #include <cmath>
+#include <array>
 #include <algorithm>
 #include <x.hpp>
 
@@ -38,6 +39,52 @@ namespace X
     return v;
   }
   
+  /*!
+   Philox4x32-10 counter based generator, J. Salmon et al., "Parallel random numbers: as easy as
+   1, 2, 3", SC 2011. Output is a pure function of counter and key, so numbers can be drawn in any
+   order and on any thread, e.g. keyed by a seed and counted by sample and draw index.
+   */
+  struct Philox4x32
+  {
+    typedef std::array<uint32_t, 4> Counter;
+    
+    /// 128 random bits of \c _counter under \c _key.
+    static Counter generate(Counter _counter, uint64_t _key)
+    {
+      uint32_t key0 = uint32_t(_key);
+      uint32_t key1 = uint32_t(_key >> 32);
+      for (uint32_t round = 0; round < 10; ++round)
+      {
+        uint64_t product0 = uint64_t(0xD2511F53u) * _counter[0];
+        uint64_t product1 = uint64_t(0xCD9E8D57u) * _counter[2];
+        Counter next = {{
+          uint32_t(product1 >> 32) ^ _counter[1] ^ key0,
+          uint32_t(product1),
+          uint32_t(product0 >> 32) ^ _counter[3] ^ key1,
+          uint32_t(product0)
+        }};
+        _counter = next;
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+      }
+      return _counter;
+    }
+  };
+  
+  /// Uniform float in (0, 1) from 32 random bits, never 0 so it can be passed to \c log.
+  inline float uniformOpen01(uint32_t _bits)
+  {
+    return (float(_bits >> 8) + 0.5f) * (1.f / 16777216.f);
+  }
+  
+  /// Two independent standard normal numbers from 64 random bits, Box-Muller transform.
+  inline void normal2(uint32_t _bits0, uint32_t _bits1, float& _z0, float& _z1)
+  {
+    float radius = std::sqrt(-2.f * std::log(uniformOpen01(_bits0) ) );
+    float angle = 6.28318530718f * uniformOpen01(_bits1);
+    _z0 = radius * std::cos(angle);
+    _z1 = radius * std::sin(angle);
+  }
   
 }
 
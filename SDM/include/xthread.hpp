@@ -0,0 +1,107 @@
+/*
+ XThread :: X thread helpers
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef X_THREAD_H_HEADER_GUARD
+#define X_THREAD_H_HEADER_GUARD
+
+#include <stdint.h> // uint32_t
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace X
+{
+  ///
+  inline uint32_t numHardwareThreads()
+  {
+    uint32_t num = std::thread::hardware_concurrency();
+    return 0 == num ? 1 : num;
+  }
+
+  /// Number of threads to use for \c _requested, 0 means one per hardware thread.
+  inline uint32_t numThreads(uint32_t _requested)
+  {
+    return 0 == _requested ? numHardwareThreads() : _requested;
+  }
+
+  /*!
+   Call \c _fn(threadId, index) for every index in [0, _num) on up to \c _numThreads threads,
+   the calling thread is one of them. Indices are handed out dynamically in chunks of \c _grain,
+   so the order of calls is unspecified; write results by index to keep them deterministic.
+   The first exception thrown by \c _fn stops remaining work and is rethrown on the calling thread.
+
+   @param _num        Number of indices.
+   @param _numThreads Number of threads, 0 means one per hardware thread.
+   @param _fn         Functor \c void(uint32_t _threadId, uint32_t _index), \c _threadId < \c _numThreads.
+   @param _grain      Indices grabbed at once by a thread.
+   */
+  template<typename Fn>
+  void parallelFor(uint32_t _num, uint32_t _numThreads, Fn _fn, uint32_t _grain = 1)
+  {
+    _grain = std::max<uint32_t>(_grain, 1);
+    uint32_t num_threads = std::min(numThreads(_numThreads), (_num + _grain - 1) / _grain);
+    if (num_threads <= 1)
+    {
+      for (uint32_t ii = 0; ii < _num; ++ii)
+        _fn(0u, ii);
+      return;
+    }
+
+    std::atomic<uint32_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&](uint32_t _threadId)
+    {
+      try
+      {
+        for (uint32_t begin = next.fetch_add(_grain); begin < _num && !failed; begin = next.fetch_add(_grain) )
+        {
+          uint32_t end = std::min(_num, begin + _grain);
+          for (uint32_t ii = begin; ii < end; ++ii)
+            _fn(_threadId, ii);
+        }
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed.exchange(true) )
+          error = std::current_exception();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (uint32_t tt = 1; tt < num_threads; ++tt)
+      threads.emplace_back(worker, tt);
+    worker(0);
+    for (auto& thread : threads)
+      thread.join();
+
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+}
+
+
+#endif //X_THREAD_H_HEADER_GUARD
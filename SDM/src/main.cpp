@@ -23,6 +23,13 @@
 #include "x.hpp"
 #include "ximgproc.hpp"
 #include "iodata.hpp"
+#include "facecache.hpp"
+#include "facebox.hpp"
+#include "shape.hpp"
+#include "samples.hpp"
+#include "designmatrix.hpp"
+#include "xthread.hpp"
+#include "xmath.hpp"
 
 #include "superviseddescent/superviseddescent.hpp"
 #include "superviseddescent/regressors.hpp"
@@ -33,32 +40,23 @@ const cv::Vec3f RED{0,0,255};
 const cv::Vec3f GREEN{0,255,0};
 const cv::Vec3f CYAN{255,128,0};
 
-double norm(const rcr::Landmark<cv::Vec2f>& prediction, const rcr::Landmark<cv::Vec2f>& groundtruth)
-{
-  return cv::norm(prediction.coordinates, groundtruth.coordinates, cv::NORM_L2);
-};
-
-cv::Mat elementwise_norm(const rcr::LandmarkCollection<cv::Vec2f>& prediction, const rcr::LandmarkCollection<cv::Vec2f>& groundtruth)
-{
-  assert(prediction.size() == groundtruth.size());
-  cv::Mat result(1, prediction.size(), CV_32FC1); // a row with each entry a norm
-  for (std::size_t i = 0; i < prediction.size(); ++i) {
-    result.at<float>(i) = norm(prediction[i], groundtruth[i]);
-  }
-  return result;
-};
-
-///
-cv::Mat calculate_normalised_landmark_errors(cv::Mat predictions, cv::Mat groundtruth, std::vector<std::string> model_landmarks, std::vector<std::string> right_eye_identifiers, std::vector<std::string> left_eye_identifiers)
+/// Per landmark errors of Helen rows, each normalised with the inter eye distance of its prediction.
+cv::Mat calculate_normalised_landmark_errors(const cv::Mat& predictions, const cv::Mat& groundtruth)
 {
   assert(predictions.rows == groundtruth.rows && predictions.cols == groundtruth.cols);
-  cv::Mat normalised_errors;
+  assert(predictions.type() == CV_32F && groundtruth.type() == CV_32F);
+  const int n = predictions.cols / 2;
+  cv::Mat normalised_errors(predictions.rows, n, CV_32F);
   for (int r = 0; r < predictions.rows; ++r) {
-    auto pred = rcr::to_landmark_collection(predictions.row(r), model_landmarks);
-    auto gt = rcr::to_landmark_collection(groundtruth.row(r), model_landmarks);
-    // calculates the element-wise norm, normalised with the IED:
-    cv::Mat landmark_norms = elementwise_norm(pred, gt).mul(1.0f / rcr::get_ied(pred, right_eye_identifiers, left_eye_identifiers));
-    normalised_errors.push_back(landmark_norms);
+    const float* pred = predictions.ptr<float>(r);
+    const float* gt = groundtruth.ptr<float>(r);
+    float* errors = normalised_errors.ptr<float>(r);
+    float inv_ied = 1.0f / SDM::Helen::interEyeDistance(pred, pred + n);
+    for (int i = 0; i < n; ++i) {
+      float dx = pred[i] - gt[i];
+      float dy = pred[i + n] - gt[i + n];
+      errors[i] = std::sqrt(dx * dx + dy * dy) * inv_ied;
+    }
   }
   return normalised_errors;
 };
@@ -87,24 +85,24 @@ void drawLandmarks(cv::Mat& _img, const cv::Mat& _lmks, const cv::Vec3f& _color,
 
 
 ///
-boost::optional<cv::Rect> validFace(const std::vector<cv::Rect>& _detectedFaces, const rcr::LandmarkCollection<cv::Vec2f>& _lmks)
+boost::optional<cv::Rect> validFace(const std::vector<cv::Rect>& _detectedFaces, const SDM::LandmarkSet& _lmks, uint32_t _sample)
 {
-  rcr::LandmarkCollection<cv::Vec2f> key_lmks(_lmks.size());
+  cv::Point key_lmks[std::extent<decltype(SDM::Helen::kValidation)>::value];
   std::vector<cv::Rect> valid_face(_detectedFaces.size());
   std::vector<cv::Rect>::iterator vf_iter;
-  rcr::LandmarkCollection<cv::Vec2f>::iterator kl_iter;
   
   if (_detectedFaces.empty())
     goto none;
   
-  kl_iter = std::copy_if(_lmks.begin(), _lmks.end(), key_lmks.begin(),
-               [](const rcr::Landmark<cv::Vec2f>& _v)
-                  { return _v.name == "144" || _v.name == "124" || _v.name == "95"; } );
-  key_lmks.resize(std::distance(key_lmks.begin(), kl_iter) ); //reduce size. This is much more efficient then push_back.
+  for (uint32_t kk = 0; kk < std::extent<decltype(key_lmks)>::value; ++kk)
+  {
+    uint16_t index = SDM::Helen::kValidation[kk];
+    key_lmks[kk] = X::toPoint(cv::Vec2f(_lmks.x(_sample)[index], _lmks.y(_sample)[index]) );
+  }
   
   vf_iter = std::copy_if(_detectedFaces.begin(), _detectedFaces.end(), valid_face.begin(),
                [&key_lmks](const cv::Rect& _box)
-                  { return std::all_of(key_lmks.begin(), key_lmks.end(), [&_box](const rcr::Landmark<cv::Vec2f>& _v){ return _box.contains(X::toPoint(_v.coordinates)) ; } ) ; } );
+                  { return std::all_of(std::begin(key_lmks), std::end(key_lmks), [&_box](const cv::Point& _pt){ return _box.contains(_pt) ; } ) ; } );
   valid_face.resize(std::distance(valid_face.begin(), vf_iter) );
   
   if (1 != valid_face.size())
@@ -116,145 +114,530 @@ none:
   return boost::optional<cv::Rect>();
 }
 
-///
-int32_t train(SDM::HelenIO& _helen)
+/*!
+ Run \c _cascade on \c _img. Guided by the annotated \c _landmarks box, only the box grown by
+ \c _params.guidePadding per side is searched, at window sizes from half to twice the box. Search
+ windows are then anchored at the top left of that region instead of the image, and neighbours are
+ grouped only among candidates inside the region and size range, so boxes may differ from full frame
+ detections, see \c reportGuidedDetection.
+ 
+ @param _faces  Detected faces in coordinates of \c _img.
+ */
+void detectFaces(cv::CascadeClassifier& _cascade, const cv::Mat& _img, const SDM::FaceDetectorParams& _params,
+                 const cv::Rect& _landmarks, std::vector<cv::Rect>& _faces)
+{
+  if (!_params.isGuided() || _landmarks.area() <= 0)
+  {
+    _cascade.detectMultiScale(_img, _faces, _params.scaleFactor, _params.minNeighbors, _params.flags, _params.minSize);
+    return;
+  }
+  
+  cv::Rect roi = X::pad(_landmarks, _params.guidePadding) & cv::Rect(0, 0, _img.cols, _img.rows);
+  int32_t side = std::max(_landmarks.width, _landmarks.height);
+  cv::Size min_size(std::max(_params.minSize.width, side / 2), std::max(_params.minSize.height, side / 2) );
+  cv::Size max_size(std::min(roi.width, 2 * side), std::min(roi.height, 2 * side) );
+  if (roi.width < min_size.width || roi.height < min_size.height)
+  {
+    _faces.clear();
+    return;
+  }
+  
+  _cascade.detectMultiScale(_img(roi), _faces, _params.scaleFactor, _params.minNeighbors, _params.flags, min_size, max_size);
+  for (auto& face : _faces)
+    face += roi.tl();
+}
+
+/*!
+ Detect \c _numSamples images spread over \c _data both guided by landmarks and on full frames, and
+ print how faces accepted by \c validFace differ: center offset relative to the full frame box size,
+ and guided over full frame box width. Guided detection stands in for full frame detection only if
+ offsets stay close to 0 and scales close to 1.
+ 
+ @param _cascades  One classifier per worker.
+ @param _guided    Parameters of guided detection, full frame detection uses the same with no padding.
+ */
+void reportGuidedDetection(std::vector<cv::CascadeClassifier>& _cascades, SDM::IData& _data, const SDM::FaceDetectorParams& _guided, uint32_t _numSamples)
+{
+  const SDM::LandmarkSet& landmarks = _data.getLandmarks();
+  const uint32_t num_images = landmarks.size();
+  SDM::FaceDetectorParams full = _guided;
+  full.guidePadding = -1.f;
+  
+  std::vector<boost::optional<cv::Rect>> guided_faces(_numSamples), full_faces(_numSamples);
+  X::parallelFor(_numSamples, uint32_t(_cascades.size()), [&](uint32_t _worker, uint32_t _ss)
+  {
+    uint32_t ii = uint32_t(uint64_t(_ss) * num_images / _numSamples);
+    cv::Mat img = _data.getImage(ii);
+    cv::Rect box = SDM::landmarkBounds(landmarks, ii);
+    std::vector<cv::Rect> detected_faces;
+    detectFaces(_cascades[_worker], img, _guided, box, detected_faces);
+    guided_faces[_ss] = validFace(detected_faces, landmarks, ii);
+    detectFaces(_cascades[_worker], img, full, box, detected_faces);
+    full_faces[_ss] = validFace(detected_faces, landmarks, ii);
+  } );
+  
+  // Center x, center y and scale of guided faces against full frame faces.
+  uint32_t num_both = 0, num_guided = 0, num_full = 0;
+  double sum[3] = { 0., 0., 0. }, sum_sq[3] = { 0., 0., 0. };
+  for (uint32_t ss = 0; ss < _numSamples; ++ss)
+  {
+    num_guided += guided_faces[ss] && !full_faces[ss];
+    num_full += full_faces[ss] && !guided_faces[ss];
+    if (!guided_faces[ss] || !full_faces[ss])
+      continue;
+    
+    const cv::Rect& guided = guided_faces[ss].get();
+    const cv::Rect& face = full_faces[ss].get();
+    double offsets[3] =
+    {
+      (guided.x + 0.5 * guided.width - face.x - 0.5 * face.width) / face.width,
+      (guided.y + 0.5 * guided.height - face.y - 0.5 * face.height) / face.height,
+      double(guided.width) / face.width,
+    };
+    for (uint32_t kk = 0; kk < 3; ++kk)
+    {
+      sum[kk] += offsets[kk];
+      sum_sq[kk] += offsets[kk] * offsets[kk];
+    }
+    ++num_both;
+  }
+  
+  std::cout << "Guided against full frame detection on " << _numSamples << " images: " << num_both << " faces in both, "
+            << num_guided << " only guided, " << num_full << " only full frame" << std::endl;
+  const char* names[3] = { "center x offset", "center y offset", "scale" };
+  for (uint32_t kk = 0; kk < 3 && 0 != num_both; ++kk)
+  {
+    double mean = sum[kk] / num_both;
+    double sigma = std::sqrt(std::max(0., sum_sq[kk] / num_both - mean * mean) );
+    std::cout << "  " << names[kk] << ": mean " << mean << ", sigma " << sigma << std::endl;
+  }
+}
+
+/// Counter based random streams of \c train, numbers are keyed by seed and counted by image and draw.
+enum RandomStream
+{
+  kRandomPerturbation = 0,
+  kRandomCalibration = 1,
+};
+
+/// Normal distribution of \c X::perturb arguments: translation ratio x, y and scale.
+struct PerturbDistribution
+{
+  cv::Vec3f mean;
+  cv::Vec3f sigma;
+};
+
+/*!
+ Perturb \c _face with draw \c _draw of image \c _image. A pure function of its arguments, so boxes
+ are identical whatever order and thread they are generated in.
+ */
+cv::Rect randomPerturb(const cv::Rect& _face, const PerturbDistribution& _dist, uint64_t _seed, RandomStream _stream, uint32_t _image, uint32_t _draw)
+{
+  auto bits = X::Philox4x32::generate({{_image, _draw, uint32_t(_stream), 0}}, _seed);
+  float z[4];
+  X::normal2(bits[0], bits[1], z[0], z[1]);
+  X::normal2(bits[2], bits[3], z[2], z[3]);
+  return X::perturb(_face, _dist.mean[0] + _dist.sigma[0] * z[0], _dist.mean[1] + _dist.sigma[1] * z[1], _dist.mean[2] + _dist.sigma[2] * z[2]);
+}
+
+/// Box relative position where \c rcr::align_mean puts the normalised origin, probed once.
+cv::Point2f alignOrigin()
+{
+  static const cv::Point2f origin = []()
+  {
+    const int32_t size = 1 << 16;
+    cv::Mat aligned = rcr::align_mean(cv::Mat::zeros(1, 2, CV_32F), cv::Rect(0, 0, size, size) );
+    return cv::Point2f(aligned.at<float>(0, 0) / size, aligned.at<float>(0, 1) / size);
+  }();
+  return origin;
+}
+
+/// Move landmarks of \c _sample by \c _offset.
+void translate(SDM::LandmarkSet& _lmks, uint32_t _sample, const cv::Point& _offset)
+{
+  float* xs = _lmks.x(_sample);
+  float* ys = _lmks.y(_sample);
+  for (uint32_t ii = 0; ii < _lmks.numLandmarks(); ++ii)
+  {
+    xs[ii] += _offset.x;
+    ys[ii] += _offset.y;
+  }
+}
+
+/// Options of \c train.
+struct TrainOptions
+{
+  TrainOptions()
+    : cropFaces(true)
+    , cropPadding(0.5f)
+    , numThreads(0)
+    , decodeThreads(0)
+    , detectPadding(-1.f)
+    , detectCheckSamples(100)
+    , calibrationSamples(200)
+    , procrustesMean(false)
+    , seed(0)
+  {
+  }
+  
+  bool      cropFaces;          //!< Keep a padded crop of every accepted face instead of the full frame.
+  float     cropPadding;        //!< Crop margin on every side of the face box, relative to box size. Covers perturbations and HoG patches.
+  uint32_t  numThreads;         //!< Face detection workers, 0 means the hardware threads left by decoders.
+  uint32_t  decodeThreads;      //!< Image decoders running next to detection workers, 0 means the hardware threads left by workers, half of them if both are 0.
+  fs::path  faceCache;          //!< Optional \c SDM::FaceDetectionCache file, detections of unchanged images are reused.
+  float     detectPadding;      //!< Detect faces only in the landmark box grown by this ratio per side, negative searches full frames.
+  uint32_t  detectCheckSamples; //!< With guided detection, images also detected on full frames to report how boxes differ, 0 skips the check.
+  fs::path  boxCalibration;     //!< Detector free mode: face boxes from landmark boxes through this \c SDM::BoxCalibration file, fitted first if missing.
+  uint32_t  calibrationSamples; //!< Images detected to fit a missing box calibration.
+  bool      procrustesMean;     //!< Initialise x0 with the generalised Procrustes mean instead of the plain mean shape.
+  uint64_t  seed;               //!< Seed of box perturbations, 0 draws one. Saved next to the model to reproduce a run.
+};
+
+/*!
+ Train on any dataset of Helen 194 annotations. Image files, \c SDM::ImageFileIO, are decoded in
+ background and frames are freed as soon as their face is cropped; other datasets, e.g. pack files
+ or a shared segment, hand out images through \c SDM::IData::getImage.
+ */
+int32_t train(SDM::IData& _data, const TrainOptions& _options = TrainOptions())
 {
   
   using namespace superviseddescent;
   
   std::vector<uint32_t> train_ids;
   std::vector<cv::Rect> train_faces;
-  std::vector<cv::Mat>  train_x_gt_normlized;
+  std::vector<cv::Mat>  train_imgs; // full frame or face crop, train_faces and train_lmks are in its coordinates
+
+  SDM::ImageFileIO* files = dynamic_cast<SDM::ImageFileIO*>(&_data);
+  const SDM::LoadPolicy policy = files ? files->getLoadPolicy() : SDM::LoadPolicy();
+  const SDM::LandmarkSet& landmarks = _data.getLandmarks();
+  if (SDM::Helen::kNumLandmarks != landmarks.numLandmarks())
+  {
+    throw std::runtime_error("Training needs Helen 194 annotations.");
+  }
+  SDM::LandmarkSet      train_lmks(landmarks.getNames() );
   
   cv::Mat  x0; // initialize of mean face landmarks
   cv::Mat  x_gt; // ground truth for training
-  std::vector<cv::Mat>  training_imgs;
   
-  float perturb_t_mu = 0.f;
-  float perturb_t_sigma = 0.04f;
-  float perturb_s_mu = 1.f;
-  float perturb_s_sigma = 0.04f;
+  PerturbDistribution perturb_dist = { cv::Vec3f(0.f, 0.f, 1.f), cv::Vec3f(0.04f, 0.04f, 0.04f) };
   
   uint16_t num_perturbations = 0; // = 10 perturbations + 1 original = 11 total
   
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::normal_distribution<> dist_t(perturb_t_mu, perturb_t_sigma);
-  std::normal_distribution<> dist_s(perturb_s_mu, perturb_s_sigma);
+  uint64_t seed = _options.seed;
+  while (0 == seed)
+  {
+    std::random_device rd;
+    seed = (uint64_t(rd()) << 32) | rd();
+  }
+  X_TRACE("Random seed %llu", (unsigned long long)seed)
+  
+  uint32_t num_images = uint32_t(_data.getFilenames().size());
   
-  cv::CascadeClassifier face_cascade;
-  if (!face_cascade.load(faceDetector))
+  // Smallest face is 50x50 at full resolution.
+  uint32_t reduction = policy.reduction;
+  SDM::FaceDetectorParams detector;
+  detector.cascade = faceDetector;
+  detector.scaleFactor = 1.2;
+  detector.minNeighbors = 2;
+  detector.minSize = cv::Size(50 / reduction, 50 / reduction);
+  detector.imreadFlags = policy.imreadFlags();
+  detector.guidePadding = _options.detectPadding < 0.f ? -1.f : _options.detectPadding;
+  detector.cascadeHash = SDM::hashFile(faceDetector);
+  
+  // Detector free mode maps landmark boxes to detector boxes, the detector only runs to fit the map once.
+  // A map fitted on another detector does not hold for this one and is fitted again.
+  bool detector_free = !_options.boxCalibration.empty();
+  SDM::BoxCalibration calibration;
+  if (detector_free && fs::exists(_options.boxCalibration) )
   {
-    throw std::runtime_error("OpenCV cascade face detector not loaded!");
-    return X::kExitFailure;
+    calibration = SDM::BoxCalibration::load(_options.boxCalibration);
+    if (!(calibration.detector == detector))
+    {
+      X_TRACE("Box calibration was fitted on other detector parameters, fitting again")
+      calibration = SDM::BoxCalibration();
+    }
   }
   
-  // Run the face detector and obtain the initial estimate x_0 using the mean landmarks.
-  for (uint32_t ii = 0; ii < _helen.getData().size(); ++ii)
+  // Detector free crops know their box before any pixel is decoded, so only the padded box is
+  // decoded. Fitting a missing calibration needs full frames, that run decodes everything.
+  bool decode_regions = detector_free && _options.cropFaces && 0 != calibration.numSamples;
+  bool prefetch = files && !decode_regions;
+  
+  // Background decoders and detection workers run at the same time, sized together they share the
+  // hardware threads instead of both taking all of them. Without prefetch workers decode themselves.
+  uint32_t num_hardware = X::numHardwareThreads();
+  uint32_t num_decoders = 0;
+  uint32_t num_workers = X::numThreads(_options.numThreads);
+  if (prefetch)
   {
-    auto& img = _helen.getData()[ii];
-    auto& lmk = _helen.getLandmarks()[ii];
-    
-    std::vector<cv::Rect> detected_faces;
-    face_cascade.detectMultiScale(img, detected_faces, 1.2, 2, 0, cv::Size(50, 50));
-    auto face = validFace(detected_faces, lmk);
-    if (!face)
+    num_decoders = _options.decodeThreads;
+    if (0 == num_decoders)
+      num_decoders = 0 == _options.numThreads ? num_hardware / 2 : num_hardware - std::min(num_hardware, _options.numThreads);
+    num_decoders = std::max<uint32_t>(1, num_decoders);
+    if (0 == _options.numThreads)
+      num_workers = num_hardware - std::min(num_hardware - 1, num_decoders);
+  }
+  num_workers = std::max<uint32_t>(1, std::min(num_workers, num_images) );
+  // Workers share the cores left by decoders, OpenCV gets only what is left per worker.
+  int cv_threads_per_worker = int(std::max<uint32_t>(1, (num_hardware - std::min(num_hardware - 1, num_decoders)) / num_workers) );
+  X_TRACE("%d detection workers, %d decoders", (int)num_workers, (int)num_decoders)
+  
+  // CascadeClassifier keeps per call state, every detection worker owns one.
+  std::vector<cv::CascadeClassifier> face_cascades;
+  if (!detector_free || 0 == calibration.numSamples)
+  {
+    face_cascades.resize(num_workers);
+    for (auto& face_cascade : face_cascades)
     {
-      X_NOOP(
-            auto d_img = img.clone();
-            drawLandmarks(d_img, lmk, {0, 0, 255} );
-            cv::imshow("d_img", d_img);
-            cv::waitKey(0);
-            )
-      continue;
+      if (!face_cascade.load(faceDetector))
+      {
+        throw std::runtime_error("OpenCV cascade face detector not loaded!");
+        return X::kExitFailure;
+      }
     }
+  }
+  
+  std::unique_ptr<SDM::FaceDetectionCache> face_cache;
+  if (!detector_free && !_options.faceCache.empty())
+  {
+    face_cache.reset(new SDM::FaceDetectionCache(_options.faceCache, detector) );
+  }
+  
+  // Image files are decoded in background, workers process them as soon as they are ready.
+  if (prefetch)
+    files->prefetch(num_decoders);
+  
+  if (detector_free && 0 == calibration.numSamples)
+  {
+    // Fit on images spread over the dataset, faces rejected by validFace do not count.
+    uint32_t num_samples = std::min(std::max<uint32_t>(_options.calibrationSamples, 1), num_images);
+    std::vector<boost::optional<cv::Rect>> sample_faces(num_samples);
+    X::ScopedCvThreads cv_threads(cv_threads_per_worker);
+    X::parallelFor(num_samples, num_workers, [&](uint32_t _worker, uint32_t _ss)
+    {
+      uint32_t ii = uint32_t(uint64_t(_ss) * num_images / num_samples);
+      std::vector<cv::Rect> detected_faces;
+      detectFaces(face_cascades[_worker], _data.getImage(ii), detector, SDM::landmarkBounds(landmarks, ii), detected_faces);
+      sample_faces[_ss] = validFace(detected_faces, landmarks, ii);
+    } );
     
-    X_NOOP(
-          auto d_img = img.clone();
-          cv::rectangle(d_img, face.get(), {0, 255, 0} );
-          drawLandmarks(d_img, lmk, {0, 255, 0} );
-          cv::imshow("d_img", d_img);
-          cv::waitKey(0);
-          )
-    
-    // Here we save training info
-    train_ids.emplace_back(ii);
-    train_faces.emplace_back(face.get() );
+    std::vector<cv::Rect> landmark_boxes, face_boxes;
+    for (uint32_t ss = 0; ss < num_samples; ++ss)
+    {
+      if (!sample_faces[ss])
+        continue;
+      landmark_boxes.emplace_back(SDM::landmarkBounds(landmarks, uint32_t(uint64_t(ss) * num_images / num_samples)) );
+      face_boxes.emplace_back(sample_faces[ss].get() );
+    }
+    calibration = SDM::BoxCalibration::fit(landmark_boxes, face_boxes, detector);
+    calibration.save(_options.boxCalibration);
+    X_TRACE("Box calibration fitted on %d of %d sampled faces", (int)calibration.numSamples, (int)num_samples)
   }
   
-  // Get all faces normlized landmarks.
-  for (uint32_t ii = 0; ii < train_ids.size(); ++ii)
+  if (!detector_free && detector.isGuided() && 0 != _options.detectCheckSamples)
   {
-    // calculate mean
-    auto box = train_faces[ii];
-    auto pts  = _helen.getLandmarks()[ train_ids[ii] ];
+    X::ScopedCvThreads cv_threads(cv_threads_per_worker);
+    reportGuidedDetection(face_cascades, _data, detector, std::min(_options.detectCheckSamples, num_images) );
+  }
+  
+  // Run the face detector, or the calibration, to obtain face boxes for the initial estimate x_0.
+  // Results are kept by image index and gathered afterwards, so order does not depend on scheduling.
+  std::vector<boost::optional<cv::Rect>> faces(num_images);
+  std::vector<cv::Mat> frames(num_images); // face crop, or full frame without cropFaces
+  std::vector<cv::Rect> crop_rois(num_images);
+  std::vector<uint64_t> content_hashes(num_images);
+  std::vector<SDM::FaceDetection> detections(num_images);
+  std::vector<uint8_t> updated(num_images, 0);
+  {
+    X::ScopedCvThreads cv_threads(cv_threads_per_worker);
+    X::parallelFor(num_images, num_workers, [&](uint32_t _worker, uint32_t _ii)
+    {
+      if (detector_free)
+      {
+        faces[_ii] = calibration.apply(SDM::landmarkBounds(landmarks, _ii) );
+        if (decode_regions)
+        {
+          crop_rois[_ii] = X::pad(faces[_ii].get(), _options.cropPadding);
+          frames[_ii] = _data.getImageRegion(_ii, crop_rois[_ii]);
+          if (frames[_ii].empty())
+            faces[_ii].reset();
+          return;
+        }
+      }
+
+      cv::Mat img = _data.getImage(_ii);
+      if (!detector_free)
+      {
+        SDM::FaceDetection& detection = detections[_ii];
+        uint64_t landmarks_hash = X::hash64(landmarks.x(_ii), 2 * landmarks.numLandmarks() * sizeof(float) );
+        bool cached = false;
+        if (face_cache)
+        {
+          content_hashes[_ii] = face_cache->contentHash(_data.getFilenames()[_ii]);
+          cached = face_cache->find(content_hashes[_ii], detection)
+                && (!detector.isGuided() || detection.landmarksHash == landmarks_hash);
+        }
+        
+        if (!cached)
+        {
+          detectFaces(face_cascades[_worker], img, detector, SDM::landmarkBounds(landmarks, _ii), detection.faces);
+        }
+        
+        // Verdict depends on annotations too, redo it from cached boxes when they changed.
+        if (!cached || detection.landmarksHash != landmarks_hash)
+        {
+          auto face = validFace(detection.faces, landmarks, _ii);
+          detection.valid = face ? int32_t(std::find(detection.faces.begin(), detection.faces.end(), face.get()) - detection.faces.begin()) : -1;
+          detection.landmarksHash = landmarks_hash;
+          updated[_ii] = 1;
+        }
+        
+        if (detection.valid < 0)
+        {
+          if (files)
+            files->releaseImage(_ii);
+          return;
+        }
+        faces[_ii] = detection.faces[detection.valid];
+      }
+      
+      if (_options.cropFaces)
+      {
+        // Only the crop is kept alive, the full frame is freed.
+        crop_rois[_ii] = X::pad(faces[_ii].get(), _options.cropPadding) & cv::Rect(0, 0, img.cols, img.rows);
+        frames[_ii] = img(crop_rois[_ii]).clone();
+        if (files)
+          files->releaseImage(_ii);
+      }
+      else
+      {
+        frames[_ii] = img;
+      }
+    } );
+  }
+  
+  if (face_cache)
+  {
+    uint32_t num_updated = 0;
+    for (uint32_t ii = 0; ii < num_images; ++ii)
+    {
+      if (updated[ii] && 0 != content_hashes[ii])
+      {
+        face_cache->insert(content_hashes[ii], detections[ii]);
+        ++num_updated;
+      }
+    }
+    face_cache->save();
+    X_TRACE("Face cache: %d of %d images detected or validated again", (int)num_updated, (int)num_images)
+  }
+  
+  // Calibrated boxes are the expected detection, jitter them by the spread real detections have.
+  PerturbDistribution calib_dist = { cv::Vec3f(0.f, 0.f, 1.f), cv::Vec3f(calibration.sigmaX, calibration.sigmaY, calibration.sigmaScale) };
+  
+  // Here we save training info, in image order.
+  for (uint32_t ii = 0; ii < num_images; ++ii)
+  {
+    if (!faces[ii])
+      continue;
     
-    float x = box.x + box.width / 2.f;
-    float y = box.y + box.height / 2.f;
+    cv::Rect face = faces[ii].get();
+    if (detector_free)
+      face = randomPerturb(face, calib_dist, seed, kRandomCalibration, ii, 0);
     
-    cv::Mat normlized(1, 194*2, CV_32F);
-    for (uint32_t jj = 0; jj < 194; ++jj)
+    train_ids.emplace_back(ii);
+    train_lmks.append(landmarks, ii);
+    train_imgs.emplace_back(std::move(frames[ii]) );
+    if (_options.cropFaces)
+    {
+      train_faces.emplace_back(face - crop_rois[ii].tl() );
+      translate(train_lmks, train_lmks.size() - 1, -crop_rois[ii].tl() );
+    }
+    else
     {
-      auto pt = pts[jj].coordinates;
-      float dx = (pt[0] - x) / box.width;
-      float dy = (pt[1] - y) / box.height;
-      normlized.at<float>(0, jj)     = dx;
-      normlized.at<float>(0, jj+194) = dy;
+      train_faces.emplace_back(face);
     }
-    train_x_gt_normlized.emplace_back(normlized);
+    
+    X_NOOP(
+          auto d_img = train_imgs.back().clone();
+          cv::rectangle(d_img, train_faces.back(), {0, 255, 0} );
+          drawLandmarks(d_img, train_lmks.toCollection(train_lmks.size() - 1), {0, 255, 0} );
+          cv::imshow("d_img", d_img);
+          cv::waitKey(0);
+          )
   }
   
+  // Get all faces normlized landmarks, in one pass over the landmark rows.
+  const uint32_t num_train = uint32_t(train_ids.size());
+  const uint32_t num_lmks = train_lmks.numLandmarks();
+  cv::Mat train_x_gt_normlized(num_train, 2 * num_lmks, CV_32F);
+  SDM::normaliseShapes(train_lmks.data(), train_faces.data(), num_train, num_lmks, train_x_gt_normlized.ptr<float>() );
+  
   // Double check.
-  if (train_ids.size() != train_faces.size() || train_faces.size() != train_x_gt_normlized.size() )
+  if (train_ids.size() != train_faces.size() || train_faces.size() != train_lmks.size() )
   {
     throw std::runtime_error("Dimensions not matched. Something is wrong here.");
     return X::kExitFailure;
   }
   
-  cv::Mat mean = std::accumulate(train_x_gt_normlized.begin(), train_x_gt_normlized.end(), cv::Mat::zeros(1, 194*2, CV_32F) )
-                  / (float)train_x_gt_normlized.size();
+  // Both means are cheap, the one not used is only reported.
+  cv::Mat plain_mean(1, 2 * num_lmks, CV_32F);
+  cv::Mat procrustes_mean(1, 2 * num_lmks, CV_32F);
+  SDM::meanShape(train_x_gt_normlized.ptr<float>(), num_train, num_lmks, plain_mean.ptr<float>(), _options.numThreads);
+  SDM::procrustesMean(train_x_gt_normlized.ptr<float>(), num_train, num_lmks, procrustes_mean.ptr<float>(), _options.numThreads);
+  cv::Mat mean = _options.procrustesMean ? procrustes_mean : plain_mean;
   
-  for (uint32_t ii = 0; ii < train_ids.size(); ++ii)
+  // Samples are (face, draw) descriptors and everything per sample derives from them: draw 0 is
+  // the face box, draw d > 0 perturbation d - 1, which only depends on seed and image id. So rows
+  // are generated in parallel, the same for any number of threads.
+  const SDM::SampleTable samples(num_train, num_perturbations + 1);
+  const cv::Point2f origin = alignOrigin(); // same placement as rcr::align_mean, used by the model at detection time
+  auto sample_box = [&](const SDM::TrainingSample& _sample)
   {
-    auto& img = _helen.getData()[train_ids[ii] ];
-    auto& normlized_lmk = train_x_gt_normlized[ii];
-    auto& face = train_faces[ii];
-    
-    auto lmk_gt = rcr::align_mean(normlized_lmk, face);
-    auto lmk_mean = rcr::align_mean(mean, face);
-    
-    x0.push_back(lmk_mean);
-    x_gt.push_back(lmk_gt);
-    training_imgs.emplace_back(img);
-    
-    /// debug only
-    X_MACRO_DEBUG(
-                  auto d_img = img.clone();
-                  cv::rectangle(d_img, face, GREEN);
-                  )
-
-    for (uint32_t pp = 0 ; pp < num_perturbations; ++pp)
+    const cv::Rect& face = train_faces[_sample.face];
+    return 0 == _sample.draw ? face : randomPerturb(face, perturb_dist, seed, kRandomPerturbation, train_ids[_sample.face], _sample.draw - 1);
+  };
+  // Design matrices are allocated once at their final size, one sample per row as the solver reads them.
+  auto place_mean = [&](const cv::Mat& _mean)
+  {
+    return SDM::buildDesignMatrix(samples.size(), 2 * num_lmks, _options.numThreads, [&](uint32_t _ss, float* _row)
     {
-      cv::Rect tmp_pert = X::perturb(face, dist_t(gen), dist_t(gen), dist_s(gen) );
-      
-      /// debug only
-      X_MACRO_DEBUG(cv::rectangle(d_img, tmp_pert, {255,0,0} ); )
-      X_MACRO_DEBUG(drawLandmarks(d_img, rcr::align_mean(mean, tmp_pert), GREEN, false, 2.f); )
-      
-      x0.push_back(rcr::align_mean(mean, tmp_pert) );
-      x_gt.push_back(lmk_gt);
-      
-      training_imgs.emplace_back(img);
-    }
-    X_NOOP(
-                  drawLandmarks(d_img, lmk_gt, CYAN);
-                  drawLandmarks(d_img, lmk_mean, RED);
-                  cv::imshow("d_img", X::scaleImg(d_img, 800) );
-                  cv::waitKey(0);
-                  )
+      cv::Rect box = sample_box(samples.at(_ss));
+      SDM::alignShapes(_mean.ptr<float>(), 0, &box, 0, 1, num_lmks, origin, _row);
+    }, 64);
+  };
+  
+  // x_gt repeats the ground truth of a face for each of its draws.
+  x0 = place_mean(mean);
+  x_gt = SDM::buildDesignMatrix(samples.size(), 2 * num_lmks, _options.numThreads, [&](uint32_t _ss, float* _row)
+  {
+    uint32_t face = samples.at(_ss).face;
+    SDM::alignShapes(train_x_gt_normlized.ptr<float>(face), 0, &train_faces[face], 0, 1, num_lmks, origin, _row);
+  }, 64);
+  
+  X_NOOP(
+        for (uint32_t ii = 0; ii < num_train; ++ii)
+        {
+          auto d_img = train_imgs[ii].clone();
+          cv::rectangle(d_img, train_faces[ii], GREEN);
+          for (uint32_t dd = 1 ; dd < samples.drawsPerFace(); ++dd)
+            cv::rectangle(d_img, sample_box(samples.at(samples.first(ii) + dd)), {255,0,0} );
+          drawLandmarks(d_img, x_gt.row(samples.first(ii)), CYAN);
+          drawLandmarks(d_img, x0.row(samples.first(ii)), RED);
+          cv::imshow("d_img", X::scaleImg(d_img, 800) );
+          cv::waitKey(0);
+        }
+        )
+  
+  {
+    cv::Mat other_x0 = place_mean(_options.procrustesMean ? plain_mean : procrustes_mean);
+    double nme = cv::mean(calculate_normalised_landmark_errors(x0, x_gt))[0];
+    double other_nme = cv::mean(calculate_normalised_landmark_errors(other_x0, x_gt))[0];
+    std::cout << "Initial NME, plain mean: " << (_options.procrustesMean ? other_nme : nme)
+              << ", Procrustes mean: " << (_options.procrustesMean ? nme : other_nme)
+              << ", x0 uses the " << (_options.procrustesMean ? "Procrustes" : "plain") << " mean" << std::endl;
   }
   
-  X_TRACE("Kept %d images out of %d", training_imgs.size() / (num_perturbations+1), _helen.getData().size())
+  X_TRACE("Kept %d images out of %d", (int)num_train, (int)num_images)
   
   
   // Create 3 regularised linear regressors in series:
@@ -264,32 +647,31 @@ int32_t train(SDM::HelenIO& _helen)
   regressors.emplace_back(LinearRegressor<VerbosePartialPivLUSolver>(Regulariser(Regulariser::RegularisationType::MatrixNorm, 1.5f, false)));
   regressors.emplace_back(LinearRegressor<VerbosePartialPivLUSolver>(Regulariser(Regulariser::RegularisationType::MatrixNorm, 1.5f, false)));
   
-  std::vector<std::string> model_landmarks;
-  model_landmarks.resize(194);
-  {
-    int n = 1;
-    std::generate(model_landmarks.begin(), model_landmarks.end(), [&n]{ return std::to_string(n++); });
-  }
-  std::vector<std::string> right_eye_ids { std::to_string(_helen.getRightEye().inCorner), std::to_string(_helen.getRightEye().outCorner) };
-  std::vector<std::string> left_eye_ids { std::to_string(_helen.getLeftEye().inCorner), std::to_string(_helen.getLeftEye().outCorner) };
+  // rcr normalises and serialises the model by landmark names, our own code uses SDM::Helen indices.
+  std::vector<std::string> model_landmarks = SDM::helenLandmarkNames();
+  std::vector<std::string> right_eye_ids = SDM::Helen::names(SDM::Helen::kRightEye);
+  std::vector<std::string> left_eye_ids = SDM::Helen::names(SDM::Helen::kLeftEye);
   
   SupervisedDescentOptimiser<LinearRegressor<VerbosePartialPivLUSolver>, rcr::InterEyeDistanceNormalisation> supervised_descent_model(regressors, rcr::InterEyeDistanceNormalisation(model_landmarks, right_eye_ids, left_eye_ids));
 
   std::vector<rcr::HoGParam> hog_params{ { VlHogVariant::VlHogVariantUoctti, 5, 11, 4, 1.0f },{ VlHogVariant::VlHogVariantUoctti, 5, 10, 4, 0.7f },{ VlHogVariant::VlHogVariantUoctti, 5, 8, 4, 0.4f },{ VlHogVariant::VlHogVariantUoctti, 5, 6, 4, 0.25f } }; // 3 /*numCells*/, 12 /*cellSize*/, 4 /*numBins*/
   assert(hog_params.size() == regressors.size());
-  rcr::HogTransform hog(training_imgs, hog_params, model_landmarks, right_eye_ids, left_eye_ids);
+  // One image per face, the sample transform maps every draw of a face onto it. Features stay with
+  // rcr until SDM::HogFeatures is shown equal, see tests/hogfeatures.
+  rcr::HogTransform hog(train_imgs, hog_params, model_landmarks, right_eye_ids, left_eye_ids);
+  SDM::SampleTransform<rcr::HogTransform> sample_hog(hog, samples);
   
   // Train the model. We'll also specify an optional callback function:
   std::cout << "Training the model, printing the residual after each learned regressor: " << std::endl;
   // Note: Rename to landmark_error_callback and put in the library?
-  auto print_residual = [&x_gt, &model_landmarks, &right_eye_ids, &left_eye_ids](const cv::Mat& current_predictions) {
+  auto print_residual = [&x_gt](const cv::Mat& current_predictions) {
     std::cout << "NLSR train: " << cv::norm(current_predictions, x_gt, cv::NORM_L2) / cv::norm(x_gt, cv::NORM_L2) << std::endl;
     
-    cv::Mat normalised_error = calculate_normalised_landmark_errors(current_predictions, x_gt, model_landmarks, right_eye_ids, left_eye_ids);
+    cv::Mat normalised_error = calculate_normalised_landmark_errors(current_predictions, x_gt);
     std::cout << "Normalised LM-error train: " << cv::mean(normalised_error)[0] << std::endl;
   };
   
-  supervised_descent_model.train(x_gt, x0, cv::Mat(), hog, print_residual);
+  supervised_descent_model.train(x_gt, x0, cv::Mat(), sample_hog, print_residual);
   
   // Save the learned model:
   
@@ -301,13 +683,28 @@ int32_t train(SDM::HelenIO& _helen)
   catch (const cereal::Exception& e) {
     std::cout << e.what() << std::endl;
   }
+  
+  // The model format is rcr's, what it takes to reproduce the run goes next to it.
+  try {
+    boost::property_tree::ptree run;
+    run.put("seed", seed);
+    run.put("perturbations", num_perturbations);
+    run.put("procrustesMean", _options.procrustesMean);
+    run.put("detectorFree", detector_free);
+    boost::property_tree::write_info(outputfile.string() + ".info", run);
+  }
+  catch (const std::exception& e) {
+    std::cout << e.what() << std::endl;
+  }
   X_TRACE("Training finished...")
   return X::kExitSuccess;
 }
 
 int main(int argc, char** argv)
 {
-  auto helen = SDM::HelenIO("/Volumes/Workbench/mylab/Training-Data/Helen_Small/helen", "/Volumes/Workbench/mylab/Training-Data/Helen_Small/annotation");
+  SDM::HelenIO helen("/Volumes/Workbench/mylab/Training-Data/Helen_Small/helen", "/Volumes/Workbench/mylab/Training-Data/Helen_Small/annotation", 0,
+                     "/Volumes/Workbench/mylab/Training-Data/Helen_Small/helen.index");
+  X_TRACE("Dataset of %d images ready in %.3f s (index %s)", (int)helen.getFilenames().size(), helen.getStartupSeconds(), helen.isIndexHit() ? "hit" : "miss")
   
 //  for (uint32_t kk = 0; kk < helen.getData().size(); ++kk)
 //  {
@@ -0,0 +1,103 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdio>
+
+#include "iodata.hpp"
+
+/// Write \c _num synthetic Helen 194 annotation files into \c _dir.
+std::vector<std::string> writeHelenFiles(const fs::path& _dir, uint32_t _num)
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> dist(1.f, 2000.f);
+  std::vector<std::string> files;
+  for (uint32_t ii = 0; ii < _num; ++ii)
+  {
+    std::string name = std::to_string(100000000 + ii) + "_1";
+    fs::path file = _dir / (std::to_string(ii) + ".txt");
+    std::ofstream out(file.string(), std::ios::binary);
+    out << name << "\r\n";
+    for (uint32_t jj = 0; jj < 194; ++jj)
+      out << dist(gen) << " , " << dist(gen) << "\r\n";
+    files.emplace_back(file.string() );
+  }
+  return files;
+}
+
+template<typename Fn>
+double measure(const std::vector<std::string>& _files, Fn _read)
+{
+  auto begin = std::chrono::high_resolution_clock::now();
+  for (auto& file : _files)
+    _read(file);
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t num_files = argc > 1 ? std::stoul(argv[1]) : 5000;
+  uint32_t num_rounds = argc > 2 ? std::stoul(argv[2]) : 5;
+
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("sdm-bench-%%%%-%%%%");
+  fs::create_directories(dir);
+  auto files = writeHelenFiles(dir, num_files);
+
+  // Results must be identical before timing means anything.
+  std::vector<char> buffer;
+  for (auto& file : files)
+  {
+    auto ref = SDM::readHelenLandmarks(file);
+    auto fast = SDM::readHelenLandmarksFast(file, buffer);
+    bool same = ref.first == fast.first && ref.second.size() == fast.second.size();
+    for (size_t ii = 0; same && ii < ref.second.size(); ++ii)
+    {
+      same = ref.second[ii].name == fast.second[ii].name
+          && ref.second[ii].coordinates[0] == fast.second[ii].coordinates[0]
+          && ref.second[ii].coordinates[1] == fast.second[ii].coordinates[1];
+    }
+    if (!same)
+    {
+      std::fprintf(stderr, "Parsers disagree on %s\n", file.c_str() );
+      fs::remove_all(dir);
+      return X::kExitFailure;
+    }
+  }
+
+  // Files are in page cache here, drop caches between rounds to see reads in flight pay off.
+  double best_ref = 1e30, best_fast = 1e30, best_async = 1e30;
+  for (uint32_t rr = 0; rr < num_rounds; ++rr)
+  {
+    best_ref = std::min(best_ref, measure(files, [](const std::string& _f){ SDM::readHelenLandmarks(_f); }) );
+    best_fast = std::min(best_fast, measure(files, [&buffer](const std::string& _f){ SDM::readHelenLandmarksFast(_f, buffer); }) );
+    
+    auto begin = std::chrono::high_resolution_clock::now();
+    SDM::readHelenLandmarksFiles(files, 1);
+    auto end = std::chrono::high_resolution_clock::now();
+    best_async = std::min(best_async, std::chrono::duration<double>(end - begin).count() );
+  }
+
+  std::printf("%u files, best of %u rounds\n", num_files, num_rounds);
+  std::printf("readHelenLandmarks     : %8.3f s %10.0f files/s\n", best_ref, num_files / best_ref);
+  std::printf("readHelenLandmarksFast : %8.3f s %10.0f files/s (x%.2f)\n", best_fast, num_files / best_fast, best_ref / best_fast);
+  std::printf("readHelenLandmarksFiles: %8.3f s %10.0f files/s (x%.2f), one parser thread\n", best_async, num_files / best_async, best_ref / best_async);
+
+  fs::remove_all(dir);
+  return X::kExitSuccess;
+}
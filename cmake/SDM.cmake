@@ -15,6 +15,8 @@ set(
 	SDM_LIB_DEPENDENCES
 	${OpenCV_LIBS}
 	${Boost_LIBRARIES}
+	${CMAKE_THREAD_LIBS_INIT}
+	${VLHOG_LIBRARY}
 	)
 
 set(
@@ -27,6 +29,17 @@ set(
 	${Boost_INCLUDE_DIRS}
 	)
 
+# shm_open lives in librt on older glibc
+if( UNIX AND NOT APPLE )
+	list( APPEND SDM_LIB_DEPENDENCES rt )
+endif()
+
+if( JPEG_FOUND AND JPEG_HAS_CROP_SCANLINE )
+	list( APPEND SDM_LIB_DEPENDENCES ${JPEG_LIBRARIES} )
+	list( APPEND SDM_INCLUDE_DIRS ${JPEG_INCLUDE_DIR} )
+	add_definitions( -DX_WITH_LIBJPEG=1 )
+endif()
+
 # add target include
 target_link_libraries( SDM PUBLIC ${SDM_LIB_DEPENDENCES} )
 target_include_directories( SDM PUBLIC ${SDM_INCLUDE_DIRS} )
\ No newline at end of file
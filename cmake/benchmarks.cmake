@@ -0,0 +1,25 @@
+function( add_benchmark ARG_NAME )
+	# Get all source files
+	file( GLOB SOURCES ${ROOT_DIR}/benchmarks/${ARG_NAME}/*.cpp ${ROOT_DIR}/benchmarks/${ARG_NAME}/*.hpp ${ROOT_DIR}/benchmarks/${ARG_NAME}/*.h )
+	add_executable( bench-${ARG_NAME} ${SOURCES} )
+	target_link_libraries( bench-${ARG_NAME} PRIVATE ${SDM_LIB_DEPENDENCES} )
+	target_include_directories( bench-${ARG_NAME} PRIVATE ${SDM_INCLUDE_DIRS} )
+
+	# Custom target as BUILD_ALL benchmarks at once
+	add_dependencies( benchmarks bench-${ARG_NAME} )
+	set_target_properties( bench-${ARG_NAME} PROPERTIES FOLDER "benchmarks" )
+endfunction()
+
+
+add_custom_target( benchmarks )
+set_target_properties( benchmarks PROPERTIES FOLDER "benchmarks" )
+
+
+set(
+	BENCHMARKS
+	iodata
+	)
+
+foreach( BENCHMARK ${BENCHMARKS} )
+	add_benchmark( ${BENCHMARK} )
+endforeach()
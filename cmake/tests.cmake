@@ -2,7 +2,7 @@ include( CMakeParseArguments )
 
 function( add_test ARG_NAME )
 	# Parse arguments
-	cmake_parse_arguments( ARG "" "" "DIRECTORIES" ${ARGN} )
+	cmake_parse_arguments( ARG "LINK_SDM" "" "DIRECTORIES" ${ARGN} )
 
 	# Get all source files
 	list( APPEND ARG_DIRECTORIES "${ROOT_DIR}/tests/${ARG_NAME}" )
@@ -13,6 +13,10 @@ function( add_test ARG_NAME )
 	endforeach()
 	add_executable( test-${ARG_NAME} ${SOURCES} )
 	target_include_directories( test-${ARG_NAME} PRIVATE ${ROOT_DIR}/tests/include ${ARG_DIRECTORIES} )
+	if( ARG_LINK_SDM )
+		target_link_libraries( test-${ARG_NAME} PRIVATE ${SDM_LIB_DEPENDENCES} )
+		target_include_directories( test-${ARG_NAME} PRIVATE ${SDM_INCLUDE_DIRS} )
+	endif()
 
 	# configure_debugging( test-${ARG_NAME} WORKING_DIR ${...} )
 	# Custom target as BUILD_ALL tests at once
@@ -32,6 +36,7 @@ endif()
 set(
 	TESTS
 	xmath
+	xcache
 	)
 
 foreach( TEST ${TESTS} )
@@ -40,4 +45,23 @@ foreach( TEST ${TESTS} )
 		DIRECTORIES 
 		${SDM_DIR}/include
 		)
+endforeach()
+
+# Tests of code built on OpenCV, Boost or vl_hog, linked like SDM.
+set(
+	SDM_TESTS
+	facecache
+	datasetindex
+	shape
+	designmatrix
+	hogfeatures
+	)
+
+foreach( TEST ${SDM_TESTS} )
+	add_test(
+		${TEST}
+		LINK_SDM
+		DIRECTORIES
+		${SDM_DIR}/include
+		)
 endforeach()
\ No newline at end of file
@@ -0,0 +1,19 @@
+function( add_tool ARG_NAME )
+	# Get all source files
+	file( GLOB SOURCES ${ROOT_DIR}/tools/${ARG_NAME}/*.cpp ${ROOT_DIR}/tools/${ARG_NAME}/*.hpp ${ROOT_DIR}/tools/${ARG_NAME}/*.h )
+	add_executable( sdm-${ARG_NAME} ${SOURCES} )
+	target_link_libraries( sdm-${ARG_NAME} PUBLIC ${SDM_LIB_DEPENDENCES} )
+	target_include_directories( sdm-${ARG_NAME} PUBLIC ${SDM_INCLUDE_DIRS} )
+	set_target_properties( sdm-${ARG_NAME} PROPERTIES FOLDER "tools" )
+endfunction()
+
+
+set(
+	TOOLS
+	pack
+	share
+	)
+
+foreach( TOOL ${TOOLS} )
+	add_tool( ${TOOL} )
+endforeach()
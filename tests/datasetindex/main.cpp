@@ -0,0 +1,114 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "iodata.hpp"
+
+#include <cstring>
+
+/// Removes a scratch directory of the test.
+struct ScratchDir
+{
+  ScratchDir() : path(fs::temp_directory_path() / fs::unique_path("sdm-datasetindex-%%%%-%%%%")) { fs::create_directories(path); }
+  ~ScratchDir() { boost::system::error_code error; fs::remove_all(path, error); }
+  fs::path path;
+};
+
+SDM::DatasetIndex testIndex()
+{
+  SDM::DatasetIndex index;
+  index.imgDir = "/data/helen";
+  index.lmkDir = "/data/annotation";
+  index.imgDirTime = 1000;
+  index.lmkDirTime = 2000;
+  index.imgDirEntries = 3;
+  index.lmkDirEntries = 4;
+  index.filenames = { "/data/helen/a.jpg", "/data/helen/b.jpg" };
+  index.fileSizes = { 10, 20 };
+  index.fileTimes = { 30, 40 };
+  index.landmarks = SDM::LandmarkSet(SDM::numberedLandmarkNames(3), 2);
+  for (uint32_t ii = 0; ii < 2 * 2 * 3; ++ii)
+    index.landmarks.data()[ii] = float(ii);
+  return index;
+}
+
+std::string readBytes(const fs::path& _file)
+{
+  std::ifstream in(_file.string(), std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeBytes(const fs::path& _file, const std::string& _bytes)
+{
+  std::ofstream out(_file.string(), std::ios::binary | std::ios::trunc);
+  out << _bytes;
+}
+
+TEST_CASE( "Dataset index file", "[SDM::readDatasetIndex]" )
+{
+  ScratchDir dir;
+  fs::path file = dir.path / "helen.index";
+  SDM::writeDatasetIndex(file, testIndex());
+  std::string bytes = readBytes(file);
+
+  SECTION( "testing round trip" )
+  {
+    SDM::DatasetIndex index;
+    REQUIRE( SDM::readDatasetIndex(file, index) );
+    REQUIRE( index.imgDir == "/data/helen" );
+    REQUIRE( index.lmkDir == "/data/annotation" );
+    REQUIRE( index.imgDirTime == 1000 );
+    REQUIRE( index.lmkDirTime == 2000 );
+    REQUIRE( index.imgDirEntries == 3 );
+    REQUIRE( index.lmkDirEntries == 4 );
+    REQUIRE( index.filenames == testIndex().filenames );
+    REQUIRE( index.fileSizes == testIndex().fileSizes );
+    REQUIRE( index.fileTimes == testIndex().fileTimes );
+    REQUIRE( index.landmarks.size() == 2 );
+    REQUIRE( index.landmarks.numLandmarks() == 3 );
+    for (uint32_t ii = 0; ii < 2 * 2 * 3; ++ii)
+      REQUIRE( index.landmarks.data()[ii] == float(ii) );
+  }
+  SECTION( "testing truncated file is rejected" )
+  {
+    for (size_t size : { size_t(0), size_t(8), bytes.size() / 2, bytes.size() - 1 })
+    {
+      writeBytes(file, bytes.substr(0, size));
+      SDM::DatasetIndex index;
+      REQUIRE_FALSE( SDM::readDatasetIndex(file, index) );
+    }
+  }
+  SECTION( "testing counts the file cannot hold are rejected before allocating" )
+  {
+    // Sample and landmark counts follow magic, version, both directory names, times and entry counts.
+    size_t counts = 8 + 4 + (4 + testIndex().imgDir.size()) + (4 + testIndex().lmkDir.size()) + 2 * 8 + 2 * 4;
+    const uint32_t huge = 0xffffffffu;
+    for (size_t offset : { counts, counts + 4 })
+    {
+      std::string corrupt = bytes;
+      std::memcpy(&corrupt[offset], &huge, sizeof(huge));
+      writeBytes(file, corrupt);
+      SDM::DatasetIndex index;
+      bool loaded = true;
+      REQUIRE_NOTHROW( loaded = SDM::readDatasetIndex(file, index) );
+      REQUIRE_FALSE( loaded );
+      REQUIRE( index.filenames.empty() );
+    }
+  }
+}
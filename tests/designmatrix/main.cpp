@@ -0,0 +1,67 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "designmatrix.hpp"
+
+/// Value of row \c _row and column \c _col, distinct for every element.
+float element(uint32_t _row, uint32_t _col)
+{
+  return float(_row * 1000 + _col);
+}
+
+cv::Mat build(uint32_t _rows, uint32_t _cols, uint32_t _numThreads)
+{
+  return SDM::buildDesignMatrix(_rows, _cols, _numThreads, [_cols](uint32_t _row, float* _dst)
+  {
+    for (uint32_t cc = 0; cc < _cols; ++cc)
+      _dst[cc] = element(_row, cc);
+  }, 4);
+}
+
+TEST_CASE( "Design matrix", "[SDM::buildDesignMatrix]" )
+{
+  const uint32_t rows = 61, cols = 23;
+
+  SECTION( "testing one sample per row" )
+  {
+    for (uint32_t threads : { 1u, 3u, 0u })
+    {
+      cv::Mat matrix = build(rows, cols, threads);
+      REQUIRE( matrix.rows == int(rows) );
+      REQUIRE( matrix.cols == int(cols) );
+      REQUIRE( matrix.isContinuous() );
+      REQUIRE( 0 == size_t(matrix.data) % SDM::kCacheLine );
+      for (uint32_t rr = 0; rr < rows; ++rr)
+        for (uint32_t cc = 0; cc < cols; ++cc)
+          REQUIRE( matrix.ptr<float>(int(rr))[cc] == element(rr, cc) );
+    }
+  }
+  SECTION( "testing empty matrix" )
+  {
+    REQUIRE( build(0, cols, 2).empty() );
+  }
+}
+
+TEST_CASE( "Aligned matrix size", "[SDM::allocateAligned]" )
+{
+  // Element counts past what an int addresses must not wrap into a short buffer.
+  REQUIRE_THROWS_AS( SDM::allocateAligned(70000, 70000), std::runtime_error );
+  REQUIRE_THROWS_AS( SDM::allocateAligned(1, std::numeric_limits<int>::max() ), std::runtime_error );
+}
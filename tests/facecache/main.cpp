@@ -0,0 +1,144 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "facecache.hpp"
+
+/// Removes a scratch directory of the test.
+struct ScratchDir
+{
+  ScratchDir() : path(fs::temp_directory_path() / fs::unique_path("sdm-facecache-%%%%-%%%%")) { fs::create_directories(path); }
+  ~ScratchDir() { boost::system::error_code error; fs::remove_all(path, error); }
+  fs::path path;
+};
+
+SDM::FaceDetectorParams testParams()
+{
+  SDM::FaceDetectorParams params;
+  params.cascade = "cascade.xml";
+  params.cascadeHash = 42;
+  params.scaleFactor = 1.2;
+  params.minNeighbors = 2;
+  params.minSize = cv::Size(50, 50);
+  return params;
+}
+
+SDM::FaceDetection testDetection()
+{
+  SDM::FaceDetection detection;
+  detection.faces = { cv::Rect(10, 20, 100, 100), cv::Rect(200, 40, 60, 60) };
+  detection.landmarksHash = 7;
+  detection.valid = 1;
+  return detection;
+}
+
+void writeBytes(const fs::path& _file, const std::string& _bytes)
+{
+  std::ofstream out(_file.string(), std::ios::binary | std::ios::trunc);
+  out << _bytes;
+}
+
+TEST_CASE( "Face detection cache file", "[SDM::FaceDetectionCache]" )
+{
+  ScratchDir dir;
+  fs::path file = dir.path / "faces.cache";
+  {
+    SDM::FaceDetectionCache cache(file, testParams());
+    cache.insert(1, testDetection());
+    cache.insert(2, SDM::FaceDetection());
+    cache.save();
+  }
+
+  SECTION( "testing round trip" )
+  {
+    SDM::FaceDetectionCache cache(file, testParams());
+    REQUIRE( cache.size() == 2 );
+    SDM::FaceDetection detection;
+    REQUIRE( cache.find(1, detection) );
+    REQUIRE( detection.faces == testDetection().faces );
+    REQUIRE( detection.landmarksHash == 7 );
+    REQUIRE( detection.valid == 1 );
+    REQUIRE( cache.find(2, detection) );
+    REQUIRE( detection.faces.empty() );
+    REQUIRE( detection.valid == -1 );
+    REQUIRE_FALSE( cache.find(3, detection) );
+  }
+  SECTION( "testing other parameters ignore the file" )
+  {
+    SDM::FaceDetectorParams params = testParams();
+    params.minNeighbors = 3;
+    SDM::FaceDetectionCache cache(file, params);
+    REQUIRE( cache.size() == 0 );
+    params = testParams();
+    params.guidePadding = 1.f;
+    REQUIRE( SDM::FaceDetectionCache(file, params).size() == 0 );
+  }
+  SECTION( "testing truncated file is ignored" )
+  {
+    uintmax_t size = fs::file_size(file);
+    for (uintmax_t truncated : { size - 1, size / 2, uintmax_t(4) })
+    {
+      fs::resize_file(file, truncated);
+      REQUIRE( SDM::FaceDetectionCache(file, testParams()).size() == 0 );
+    }
+  }
+  SECTION( "testing valid index out of faces rejects the file" )
+  {
+    SDM::FaceDetectionCache cache(file, testParams());
+    SDM::FaceDetection detection = testDetection();
+    detection.valid = 2;
+    cache.insert(3, detection);
+    cache.save();
+    REQUIRE( SDM::FaceDetectionCache(file, testParams()).size() == 0 );
+  }
+}
+
+TEST_CASE( "Face detection cache content hash", "[SDM::FaceDetectionCache]" )
+{
+  ScratchDir dir;
+  fs::path file = dir.path / "faces.cache";
+  fs::path image = dir.path / "image.jpg";
+  writeBytes(image, "first content");
+  uint64_t first = SDM::hashFile(image);
+  REQUIRE( 0 != first );
+
+  {
+    SDM::FaceDetectionCache cache(file, testParams());
+    REQUIRE( cache.contentHash(image) == first );
+    REQUIRE( cache.contentHash(dir.path / "missing.jpg") == 0 );
+    cache.save();
+  }
+
+  SECTION( "testing stored hash is reused while size and mtime are unchanged" )
+  {
+    // Same size and mtime, the stale stored hash proves the file was not read again.
+    std::time_t time = fs::last_write_time(image);
+    writeBytes(image, "other content");
+    fs::last_write_time(image, time);
+    SDM::FaceDetectionCache cache(file, testParams());
+    REQUIRE( cache.contentHash(image) == first );
+  }
+  SECTION( "testing changed file is hashed again" )
+  {
+    writeBytes(image, "changed, longer content");
+    SDM::FaceDetectionCache cache(file, testParams());
+    REQUIRE( cache.contentHash(image) == SDM::hashFile(image) );
+    REQUIRE( cache.contentHash(image) != first );
+  }
+}
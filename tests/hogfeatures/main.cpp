@@ -0,0 +1,104 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "hogfeatures.hpp"
+
+#include <cstring>
+#include <random>
+
+const uint32_t kNumLandmarks = SDM::Helen::kNumLandmarks;
+
+/// Blurred 8 bit noise of \c _channels channels, gray images and BGR images go through different paths.
+cv::Mat randomImage(int32_t _width, int32_t _height, int32_t _channels, uint32_t _seed)
+{
+  cv::Mat image(_height, _width, CV_8UC(_channels) );
+  cv::theRNG().state = _seed;
+  cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256) );
+  cv::GaussianBlur(image, image, cv::Size(0, 0), 2.);
+  return image;
+}
+
+/*!
+ Landmark row of a face at (_x, _y), eyes \c _ied apart. Other landmarks scatter around the face
+ at fractional positions, so some round up, some down, and some patches cross the image border.
+ */
+cv::Mat randomRow(float _x, float _y, float _ied, std::mt19937& _gen)
+{
+  std::uniform_real_distribution<float> offset(-1.5f * _ied, 1.5f * _ied), jitter(-0.5f, 0.5f);
+  cv::Mat row(1, 2 * kNumLandmarks, CV_32F);
+  float* xs = row.ptr<float>();
+  float* ys = xs + kNumLandmarks;
+  for (uint32_t ii = 0; ii < kNumLandmarks; ++ii)
+  {
+    xs[ii] = _x + offset(_gen);
+    ys[ii] = _y + offset(_gen);
+  }
+
+  const SDM::Helen::EyeCorners& right = SDM::Helen::kRightEye;
+  const SDM::Helen::EyeCorners& left = SDM::Helen::kLeftEye;
+  xs[right.outCorner] = _x - 0.7f * _ied + jitter(_gen);
+  xs[right.inCorner] = _x - 0.3f * _ied + jitter(_gen);
+  xs[left.inCorner] = _x + 0.3f * _ied + jitter(_gen);
+  xs[left.outCorner] = _x + 0.7f * _ied + jitter(_gen);
+  for (uint16_t corner : { right.inCorner, right.outCorner, left.inCorner, left.outCorner })
+    ys[corner] = _y + jitter(_gen) * 0.2f * _ied;
+  return row;
+}
+
+TEST_CASE( "HOG features match rcr", "[SDM::HogFeatures]" )
+{
+  // Training levels, see train.
+  std::vector<rcr::HoGParam> hog_params{ { VlHogVariant::VlHogVariantUoctti, 5, 11, 4, 1.0f },{ VlHogVariant::VlHogVariantUoctti, 5, 10, 4, 0.7f },{ VlHogVariant::VlHogVariantUoctti, 5, 8, 4, 0.4f },{ VlHogVariant::VlHogVariantUoctti, 5, 6, 4, 0.25f } };
+  std::vector<cv::Mat> images{ randomImage(320, 240, 1, 1), randomImage(500, 400, 3, 2), randomImage(90, 70, 3, 3) };
+
+  rcr::HogTransform expected(images, hog_params, SDM::helenLandmarkNames(),
+                             SDM::Helen::names(SDM::Helen::kRightEye), SDM::Helen::names(SDM::Helen::kLeftEye) );
+  SDM::HogFeatures features(images, hog_params, 2);
+
+  std::mt19937 gen(5);
+  for (int ii = 0; ii < int(images.size()); ++ii)
+  {
+    const cv::Mat& image = images[ii];
+    std::uniform_real_distribution<float> x(0.f, float(image.cols) ), y(0.f, float(image.rows) );
+    std::uniform_real_distribution<float> ied(8.f, 0.6f * std::min(image.cols, image.rows) );
+
+    // Faces inside the image, then faces on corners, where most patches cross the border.
+    std::vector<cv::Mat> rows;
+    for (uint32_t rr = 0; rr < 8; ++rr)
+      rows.push_back(randomRow(x(gen), y(gen), ied(gen), gen) );
+    rows.push_back(randomRow(0.f, 0.f, ied(gen), gen) );
+    rows.push_back(randomRow(float(image.cols), float(image.rows), ied(gen), gen) );
+    rows.push_back(randomRow(-10.5f, float(image.rows) + 10.5f, ied(gen), gen) );
+
+    for (const cv::Mat& row : rows)
+    {
+      for (size_t level = 0; level < hog_params.size(); ++level)
+      {
+        cv::Mat rcr_row = expected(row, level, ii);
+        cv::Mat sdm_row = features(row, level, ii);
+        REQUIRE( rcr_row.rows == 1 );
+        REQUIRE( rcr_row.type() == sdm_row.type() );
+        REQUIRE( rcr_row.cols == sdm_row.cols );
+        REQUIRE( rcr_row.isContinuous() );
+        REQUIRE( 0 == std::memcmp(rcr_row.ptr<float>(), sdm_row.ptr<float>(), sdm_row.cols * sizeof(float)) );
+      }
+    }
+  }
+}
@@ -0,0 +1,152 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "shape.hpp"
+
+#include <cstring>
+#include <random>
+
+const uint32_t kNumLandmarks = 194;
+
+/// One shape of \c _numLandmarks points scattered inside each of \c _boxes.
+std::vector<float> randomShapes(const std::vector<cv::Rect>& _boxes, uint32_t _numLandmarks, uint32_t _seed)
+{
+  std::mt19937 gen(_seed);
+  std::uniform_real_distribution<float> dist(0.f, 1.f);
+  std::vector<float> shapes(_boxes.size() * 2 * _numLandmarks);
+  for (size_t ii = 0; ii < _boxes.size(); ++ii)
+  {
+    float* xs = shapes.data() + ii * 2 * _numLandmarks;
+    float* ys = xs + _numLandmarks;
+    for (uint32_t jj = 0; jj < _numLandmarks; ++jj)
+    {
+      xs[jj] = _boxes[ii].x + dist(gen) * _boxes[ii].width;
+      ys[jj] = _boxes[ii].y + dist(gen) * _boxes[ii].height;
+    }
+  }
+  return shapes;
+}
+
+std::vector<cv::Rect> randomBoxes(uint32_t _num, uint32_t _seed)
+{
+  std::mt19937 gen(_seed);
+  std::uniform_int_distribution<int32_t> pos(-50, 800), size(20, 400);
+  std::vector<cv::Rect> boxes(_num);
+  for (auto& box : boxes)
+    box = cv::Rect(pos(gen), pos(gen), size(gen), size(gen));
+  return boxes;
+}
+
+TEST_CASE( "Shape normalisation and alignment", "[SDM::alignShapes]" )
+{
+  const uint32_t num = 37;
+  const size_t row = 2 * kNumLandmarks;
+  std::vector<cv::Rect> boxes = randomBoxes(num, 1);
+  std::vector<float> shapes = randomShapes(boxes, kNumLandmarks, 2);
+  std::vector<float> normalised(shapes.size()), aligned(shapes.size());
+  SDM::normaliseShapes(shapes.data(), boxes.data(), num, kNumLandmarks, normalised.data());
+
+  SECTION( "testing normalised shapes are centered on their box" )
+  {
+    for (uint32_t ii = 0; ii < num; ++ii)
+      for (size_t jj = 0; jj < row; ++jj)
+      {
+        REQUIRE( normalised[ii * row + jj] >= -0.5f - 1e-6f );
+        REQUIRE( normalised[ii * row + jj] <= 0.5f + 1e-6f );
+      }
+  }
+  SECTION( "testing origin (0.5, 0.5) inverts normaliseShapes" )
+  {
+    SDM::alignShapes(normalised.data(), 1, boxes.data(), 1, num, kNumLandmarks, cv::Point2f(0.5f, 0.5f), aligned.data());
+    for (size_t jj = 0; jj < shapes.size(); ++jj)
+      REQUIRE( aligned[jj] == Approx(shapes[jj]).epsilon(1e-5) );
+  }
+  SECTION( "testing origin moves shapes by box size" )
+  {
+    std::vector<float> moved(shapes.size());
+    SDM::alignShapes(normalised.data(), 1, boxes.data(), 1, num, kNumLandmarks, cv::Point2f(0.5f, 0.5f), aligned.data());
+    SDM::alignShapes(normalised.data(), 1, boxes.data(), 1, num, kNumLandmarks, cv::Point2f(0.f, 1.f), moved.data());
+    for (uint32_t ii = 0; ii < num; ++ii)
+      for (uint32_t jj = 0; jj < kNumLandmarks; ++jj)
+      {
+        REQUIRE( moved[ii * row + jj] == Approx(aligned[ii * row + jj] - 0.5f * boxes[ii].width).epsilon(1e-5) );
+        REQUIRE( moved[ii * row + kNumLandmarks + jj] == Approx(aligned[ii * row + kNumLandmarks + jj] + 0.5f * boxes[ii].height).epsilon(1e-5) );
+      }
+  }
+  SECTION( "testing stride 0 broadcasts one shape into every box" )
+  {
+    SDM::alignShapes(normalised.data(), 0, boxes.data(), 1, num, kNumLandmarks, cv::Point2f(0.5f, 0.5f), aligned.data());
+    std::vector<float> single(row);
+    for (uint32_t ii = 0; ii < num; ++ii)
+    {
+      SDM::alignShapes(normalised.data(), 1, &boxes[ii], 1, 1, kNumLandmarks, cv::Point2f(0.5f, 0.5f), single.data());
+      REQUIRE( std::equal(single.begin(), single.end(), aligned.begin() + ii * row) );
+    }
+  }
+  SECTION( "testing stride 0 broadcasts one box to every shape" )
+  {
+    SDM::alignShapes(normalised.data(), 1, boxes.data(), 0, num, kNumLandmarks, cv::Point2f(0.5f, 0.5f), aligned.data());
+    std::vector<float> single(row);
+    for (uint32_t ii = 0; ii < num; ++ii)
+    {
+      SDM::alignShapes(normalised.data() + ii * row, 1, boxes.data(), 1, 1, kNumLandmarks, cv::Point2f(0.5f, 0.5f), single.data());
+      REQUIRE( std::equal(single.begin(), single.end(), aligned.begin() + ii * row) );
+    }
+  }
+}
+
+TEST_CASE( "Mean shapes do not depend on threads", "[SDM::meanShape][SDM::procrustesMean]" )
+{
+  // Several chunks of SDM::detail::kShapeChunk shapes, the last one partial.
+  const uint32_t num = 1000;
+  const size_t row = 2 * kNumLandmarks;
+  std::vector<cv::Rect> boxes = randomBoxes(num, 3);
+  std::vector<float> shapes = randomShapes(boxes, kNumLandmarks, 4);
+  std::vector<float> normalised(shapes.size());
+  SDM::normaliseShapes(shapes.data(), boxes.data(), num, kNumLandmarks, normalised.data());
+
+  std::vector<float> mean(row), procrustes(row);
+  SDM::meanShape(normalised.data(), num, kNumLandmarks, mean.data(), 1);
+  uint32_t iterations = SDM::procrustesMean(normalised.data(), num, kNumLandmarks, procrustes.data(), 1);
+  REQUIRE( iterations >= 1 );
+
+  SECTION( "testing mean of one shape is the shape" )
+  {
+    std::vector<float> single(row);
+    SDM::meanShape(normalised.data(), 1, kNumLandmarks, single.data(), 4);
+    REQUIRE( std::equal(single.begin(), single.end(), normalised.begin()) );
+  }
+  SECTION( "testing results are bit identical for 1 and N threads" )
+  {
+    for (uint32_t threads : { 2u, 3u, 8u, 0u })
+    {
+      std::vector<float> other_mean(row), other_procrustes(row);
+      SDM::meanShape(normalised.data(), num, kNumLandmarks, other_mean.data(), threads);
+      REQUIRE( 0 == std::memcmp(mean.data(), other_mean.data(), row * sizeof(float)) );
+      REQUIRE( SDM::procrustesMean(normalised.data(), num, kNumLandmarks, other_procrustes.data(), threads) == iterations );
+      REQUIRE( 0 == std::memcmp(procrustes.data(), other_procrustes.data(), row * sizeof(float)) );
+    }
+  }
+  SECTION( "testing Procrustes mean stays in the frame of the plain mean" )
+  {
+    for (size_t jj = 0; jj < row; ++jj)
+      REQUIRE( std::fabs(procrustes[jj] - mean[jj]) < 0.1f );
+  }
+}
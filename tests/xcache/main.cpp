@@ -0,0 +1,59 @@
+/*
+ X ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "xcache.hpp"
+
+#include <string>
+
+TEST_CASE( "Least recently used cache bounded by cost", "[X::LruCache]" )
+{
+  X::LruCache<uint32_t, std::string> cache(10);
+
+  SECTION( "testing find after insert" )
+  {
+    cache.insert(1, "one", 3);
+    REQUIRE( cache.find(1) != NULL );
+    REQUIRE( *cache.find(1) == "one" );
+    REQUIRE( cache.find(2) == NULL );
+    REQUIRE( cache.cost() == 3 );
+  }
+  SECTION( "testing eviction of least recently used" )
+  {
+    cache.insert(1, "one", 4);
+    cache.insert(2, "two", 4);
+    cache.find(1);
+    REQUIRE( cache.insert(3, "three", 4) == 1 );
+    REQUIRE( cache.find(1) != NULL );
+    REQUIRE( cache.find(2) == NULL );
+    REQUIRE( cache.find(3) != NULL );
+    REQUIRE( cache.cost() == 8 );
+    REQUIRE( cache.numEvictions() == 1 );
+  }
+  SECTION( "testing replace and oversized values" )
+  {
+    cache.insert(1, "one", 4);
+    cache.insert(1, "uno", 6);
+    REQUIRE( *cache.find(1) == "uno" );
+    REQUIRE( cache.cost() == 6 );
+    REQUIRE( cache.insert(2, "huge", 11) == 0 );
+    REQUIRE( cache.find(2) == NULL );
+    REQUIRE( cache.size() == 1 );
+  }
+}
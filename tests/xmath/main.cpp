@@ -35,3 +35,30 @@ TEST_CASE( "Return range of numbers", "[X::range]" )
 }
 
 
+
+TEST_CASE( "Counter based random numbers", "[X::Philox4x32]" )
+{
+  SECTION( "testing known answers" )
+  {
+    // Random123 known answer vectors of philox4x32_10.
+    auto zero = X::Philox4x32::generate({{0, 0, 0, 0}}, 0);
+    REQUIRE( (zero == X::Philox4x32::Counter{{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}}) );
+    auto ones = X::Philox4x32::generate({{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}}, 0xffffffffffffffffull);
+    REQUIRE( (ones == X::Philox4x32::Counter{{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}}) );
+  }
+  SECTION( "testing normal numbers" )
+  {
+    double sum = 0., sum_sq = 0.;
+    const uint32_t num = 20000;
+    for (uint32_t ii = 0; ii < num; ++ii)
+    {
+      auto bits = X::Philox4x32::generate({{ii, 0, 0, 0}}, 42);
+      float z0, z1;
+      X::normal2(bits[0], bits[1], z0, z1);
+      sum += z0 + z1;
+      sum_sq += z0 * z0 + z1 * z1;
+    }
+    REQUIRE( std::fabs(sum / (2 * num)) < 0.03 );
+    REQUIRE( std::fabs(sum_sq / (2 * num) - 1.) < 0.03 );
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "datapack.hpp"
+
+/// Convert a Helen style pair of image and annotation directories into a pack file.
+int main(int argc, char** argv)
+{
+  fs::path img_dir, lmk_dir, output;
+  uint32_t num_threads;
+
+  po::options_description desc("Usage: sdm-pack -i <images> -a <annotations> -o <pack>");
+  desc.add_options()
+    ("help,h", "Print this help.")
+    ("images,i", po::value<fs::path>(&img_dir)->required(), "Directory of .jpg images.")
+    ("annotations,a", po::value<fs::path>(&lmk_dir)->required(), "Directory of .txt annotations.")
+    ("output,o", po::value<fs::path>(&output)->required(), "Output pack file.")
+    ("threads,t", po::value<uint32_t>(&num_threads)->default_value(0), "Threads parsing annotations, 0 means one per hardware thread.");
+
+  try
+  {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return X::kExitSuccess;
+    }
+    po::notify(vm);
+
+    SDM::HelenIO helen(img_dir, lmk_dir, num_threads);
+    SDM::writePack(output, helen.getFilenames(), helen.getLandmarks());
+
+    SDM::PackIO pack(output);
+    std::cout << "Packed " << pack.size() << " samples of " << pack.numLandmarks() << " landmarks into " << output.string() << std::endl;
+  }
+  catch (const po::error& e)
+  {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return X::kExitFailure;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return X::kExitFailure;
+  }
+  return X::kExitSuccess;
+}
@@ -0,0 +1,108 @@
+/*
+ SDM ::
+
+ Copyright 2017 ZiJian Jiang
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <csignal>
+#include <unistd.h>
+
+#include "datapack.hpp"
+#include "shmdata.hpp"
+
+namespace
+{
+  volatile std::sig_atomic_t g_stop = 0;
+
+  void onSignal(int)
+  {
+    g_stop = 1;
+  }
+}
+
+/// Decode a dataset once into shared memory and hold it until interrupted, so trainings attach with SDM::SharedIO.
+int main(int argc, char** argv)
+{
+  fs::path img_dir, lmk_dir, pack, index_file;
+  std::string name;
+  uint32_t num_threads;
+
+  po::options_description desc("Usage: sdm-share -n </name> (-i <images> -a <annotations> [-x <index> [--verify-index]] | -p <pack>) [--unlink]");
+  desc.add_options()
+    ("help,h", "Print this help.")
+    ("name,n", po::value<std::string>(&name)->required(), "Shared memory segment name, e.g. /sdm-helen.")
+    ("images,i", po::value<fs::path>(&img_dir), "Directory of .jpg images.")
+    ("annotations,a", po::value<fs::path>(&lmk_dir), "Directory of .txt annotations.")
+    ("index,x", po::value<fs::path>(&index_file), "Dataset index of images and annotations, written if missing or stale.")
+    ("verify-index", "Also check size and mtime of every image against the index, a stat per image.")
+    ("pack,p", po::value<fs::path>(&pack), "Pack file written by sdm-pack.")
+    ("threads,t", po::value<uint32_t>(&num_threads)->default_value(0), "Decode threads, 0 means one per hardware thread.")
+    ("unlink", "Remove a stale segment and exit.");
+
+  try
+  {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return X::kExitSuccess;
+    }
+    po::notify(vm);
+    bool verify_index = vm.count("verify-index") != 0;
+
+    if (vm.count("unlink"))
+    {
+      X::SharedMemory::unlink(name.c_str());
+      return X::kExitSuccess;
+    }
+    if (pack.empty() == (img_dir.empty() || lmk_dir.empty()) )
+    {
+      throw po::error("Give either images and annotations, or a pack.");
+    }
+
+    SDM::SharedIO::Loader load = [&]() -> std::unique_ptr<SDM::IData>
+    {
+      if (!pack.empty())
+        return std::unique_ptr<SDM::IData>(new SDM::PackIO(pack, num_threads));
+      return std::unique_ptr<SDM::IData>(new SDM::HelenIO(img_dir, lmk_dir, num_threads, index_file, verify_index));
+    };
+    SDM::SharedIO shared(name, load, num_threads);
+    if (!shared.isPublisher())
+    {
+      throw std::runtime_error(std::string("Shared dataset is already published: " + name));
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::cout << "Sharing " << shared.getFilenames().size() << " samples, " << shared.getSegmentSize() / (1 << 20)
+              << " MiB as " << name << ", interrupt to stop." << std::endl;
+    while (!g_stop)
+      ::pause();
+
+    shared.unlink();
+  }
+  catch (const po::error& e)
+  {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return X::kExitFailure;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return X::kExitFailure;
+  }
+  return X::kExitSuccess;
+}